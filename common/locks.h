@@ -0,0 +1,338 @@
+#ifndef _LOCKS_H
+#define _LOCKS_H
+
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <mutex>
+#include <string.h>
+#include <thread>
+
+#ifdef __linux__
+#include <linux/futex.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
+
+#include "spinlock.h"
+
+/*
+ * Interchangeable mutual-exclusion locks.  Each one is Lockable
+ * (lock(), try_lock() and unlock()), so std::lock_guard,
+ * std::unique_lock and std::condition_variable_any accept any of them,
+ * and the sleeping thread pools take the type of their queue locks as
+ * a template parameter.  Like SpinLock, every waiter eventually yields
+ * its time slice instead of polling a holder that was preempted.
+ */
+
+enum LockKind {
+    LOCK_MUTEX,     // std::mutex
+    LOCK_TTAS,      // TtasLock
+    LOCK_TICKET,    // TicketLock
+    LOCK_MCS,       // McsLock
+    LOCK_FUTEX,     // FutexLock
+    NUM_LOCK_KINDS,
+};
+
+inline const char* lockKindName(LockKind kind) {
+    static const char* names[NUM_LOCK_KINDS] = {"mutex", "ttas", "ticket", "mcs", "futex"};
+    return names[kind];
+}
+
+// the LockKind called `name`, false if there is none
+inline bool parseLockKind(const char* name, LockKind& kind) {
+    for (int i = 0; i < NUM_LOCK_KINDS; i++) {
+        if (strcmp(name, lockKindName((LockKind)i)) == 0) {
+            kind = (LockKind)i;
+            return true;
+        }
+    }
+    return false;
+}
+
+/*
+ * TtasLock: test-and-test-and-set with exponential backoff.  A thread
+ * that loses the exchange pauses before looking at the lock again, twice
+ * as long after every lost round, so a release is not followed by every
+ * waiter hitting the line with an exchange at once.  At the longest
+ * backoff the waiter yields instead of pausing.
+ */
+class TtasLock {
+    public:
+        static const int kMinBackoff = 4;       // cpuRelax() calls after the first lost exchange
+        static const int kMaxBackoff = 1024;
+
+        TtasLock(): locked_(false) {}
+        static const char* name() { return "ttas"; }
+
+        void lock() {
+            int backoff = kMinBackoff;
+            while (locked_.exchange(true, std::memory_order_acquire)) {
+                do {
+                    if (backoff < kMaxBackoff) {
+                        for (int i = 0; i < backoff; i++) {
+                            cpuRelax();
+                        }
+                        backoff *= 2;
+                    } else {
+                        std::this_thread::yield();
+                    }
+                } while (locked_.load(std::memory_order_relaxed));
+            }
+        }
+        bool try_lock() {
+            return !locked_.load(std::memory_order_relaxed) && !locked_.exchange(true, std::memory_order_acquire);
+        }
+        void unlock() {
+            locked_.store(false, std::memory_order_release);
+        }
+
+    private:
+        std::atomic<bool> locked_;
+};
+
+/*
+ * TicketLock: FIFO spin lock.  Waiters take a ticket and poll the ticket
+ * being served, pausing in proportion to the number of waiters ahead of
+ * them.  The two counters sit on separate cache lines so taking a ticket
+ * does not disturb the line the waiters poll.
+ */
+class TicketLock {
+    public:
+        static const int kPausePerWaiter = 16;
+
+        TicketLock(): next_(0), serving_(0) {}
+        static const char* name() { return "ticket"; }
+
+        void lock() {
+            unsigned ticket = next_.fetch_add(1, std::memory_order_relaxed);
+            int spins = 0;
+            while (true) {
+                unsigned serving = serving_.load(std::memory_order_acquire);
+                if (serving == ticket) {
+                    return;
+                }
+                if (++spins < SpinLock::kSpinsBeforeYield) {
+                    for (unsigned i = 0; i < (ticket - serving) * kPausePerWaiter; i++) {
+                        cpuRelax();
+                    }
+                } else {
+                    std::this_thread::yield();
+                }
+            }
+        }
+        bool try_lock() {
+            unsigned ticket = serving_.load(std::memory_order_acquire);
+            return next_.compare_exchange_strong(ticket, ticket + 1, std::memory_order_acquire,
+                                                 std::memory_order_relaxed);
+        }
+        void unlock() {
+            // only the holder writes serving_
+            serving_.store(serving_.load(std::memory_order_relaxed) + 1, std::memory_order_release);
+        }
+
+    private:
+        std::atomic<unsigned> next_;
+        char pad_[64];
+        std::atomic<unsigned> serving_;
+};
+
+/*
+ * McsLock: queue lock of Mellor-Crummey and Scott.  Each waiter appends
+ * a node to the queue and polls a flag in its own node, which its
+ * predecessor clears on unlock, so a release touches one waiter's cache
+ * line only and the lock is handed out in FIFO order.
+ *
+ * Nodes come from a free list of the calling thread and go back to it in
+ * unlock(); nobody else touches a node once its lock was handed on.
+ * The node of the current holder is kept in the lock, which keeps the
+ * plain lock()/unlock() interface and lets a thread hold several MCS
+ * locks at once, released in any order.
+ */
+class McsLock {
+    public:
+        McsLock(): tail_(nullptr), owner_(nullptr) {}
+        static const char* name() { return "mcs"; }
+
+        void lock() {
+            Node* node = NodeCache::local().get();
+            node->next.store(nullptr, std::memory_order_relaxed);
+            node->locked.store(true, std::memory_order_relaxed);
+            Node* pred = tail_.exchange(node, std::memory_order_acq_rel);
+            if (pred != nullptr) {
+                pred->next.store(node, std::memory_order_release);
+                spinUntil([node]() { return !node->locked.load(std::memory_order_acquire); });
+            }
+            owner_ = node;
+        }
+        bool try_lock() {
+            if (tail_.load(std::memory_order_relaxed) != nullptr) {
+                return false;
+            }
+            Node* node = NodeCache::local().get();
+            node->next.store(nullptr, std::memory_order_relaxed);
+            node->locked.store(true, std::memory_order_relaxed);
+            Node* expected = nullptr;
+            if (!tail_.compare_exchange_strong(expected, node, std::memory_order_acq_rel,
+                                               std::memory_order_relaxed)) {
+                NodeCache::local().put(node);
+                return false;
+            }
+            owner_ = node;
+            return true;
+        }
+        void unlock() {
+            Node* node = owner_;
+            Node* next = node->next.load(std::memory_order_acquire);
+            if (next == nullptr) {
+                Node* expected = node;
+                if (tail_.compare_exchange_strong(expected, nullptr, std::memory_order_release,
+                                                  std::memory_order_relaxed)) {
+                    NodeCache::local().put(node);
+                    return;
+                }
+                // a successor already swapped itself into the tail and
+                // is about to link itself behind this node
+                spinUntil([node, &next]() {
+                    next = node->next.load(std::memory_order_acquire);
+                    return next != nullptr;
+                });
+            }
+            next->locked.store(false, std::memory_order_release);
+            NodeCache::local().put(node);
+        }
+
+    private:
+        struct Node {
+            std::atomic<Node*> next;
+            std::atomic<bool> locked;
+            Node* nextFree;
+            char pad_[64];      // waiters poll their own line only
+        };
+
+        // per-thread free list, emptied when the thread exits
+        class NodeCache {
+            public:
+                static NodeCache& local() {
+                    static thread_local NodeCache cache;
+                    return cache;
+                }
+                NodeCache(): free_(nullptr) {}
+                ~NodeCache() {
+                    while (free_ != nullptr) {
+                        Node* node = free_;
+                        free_ = node->nextFree;
+                        delete node;
+                    }
+                }
+                Node* get() {
+                    if (free_ == nullptr) {
+                        return new Node();
+                    }
+                    Node* node = free_;
+                    free_ = node->nextFree;
+                    return node;
+                }
+                void put(Node* node) {
+                    node->nextFree = free_;
+                    free_ = node;
+                }
+
+            private:
+                Node* free_;
+        };
+
+        std::atomic<Node*> tail_;
+        Node* owner_;   // node of the holder, only touched while holding the lock
+};
+
+/*
+ * FutexLock: the three-state mutex of Drepper's "Futexes Are Tricky".
+ * The word is 0 when free, 1 when held and 2 when held with possible
+ * sleepers, so an uncontended lock()/unlock() pair is two atomic
+ * instructions and no system call.  A contended waiter spins briefly,
+ * then sleeps in the kernel until unlock() wakes one sleeper.  Without
+ * futexes (other than Linux) the sleep is a yield.
+ */
+class FutexLock {
+    public:
+        static const int kSpinsBeforeSleep = 64;
+
+        FutexLock(): state_(0) {}
+        static const char* name() { return "futex"; }
+
+        void lock() {
+            int c = 0;
+            if (state_.compare_exchange_strong(c, 1, std::memory_order_acquire, std::memory_order_relaxed)) {
+                return;
+            }
+            for (int spins = 0; spins < kSpinsBeforeSleep; spins++) {
+                cpuRelax();
+                c = 0;
+                if (state_.load(std::memory_order_relaxed) == 0 &&
+                    state_.compare_exchange_strong(c, 1, std::memory_order_acquire, std::memory_order_relaxed)) {
+                    return;
+                }
+            }
+            // from here on the lock is marked as having sleepers, which
+            // at worst costs the next unlock() a spurious wake
+            while (state_.exchange(2, std::memory_order_acquire) != 0) {
+                futexWait(2);
+            }
+        }
+        bool try_lock() {
+            int c = 0;
+            return state_.compare_exchange_strong(c, 1, std::memory_order_acquire, std::memory_order_relaxed);
+        }
+        void unlock() {
+            if (state_.exchange(0, std::memory_order_release) == 2) {
+                futexWake(1);
+            }
+        }
+
+    private:
+        static_assert(sizeof(std::atomic<int>) == sizeof(int), "futex word must be a plain int");
+
+        // sleeps while the word still equals `expected`
+        void futexWait(int expected) {
+#ifdef __linux__
+            syscall(SYS_futex, reinterpret_cast<int*>(&state_), FUTEX_WAIT_PRIVATE, expected, nullptr, nullptr, 0);
+#else
+            std::this_thread::yield();
+#endif
+        }
+        void futexWake(int count) {
+#ifdef __linux__
+            syscall(SYS_futex, reinterpret_cast<int*>(&state_), FUTEX_WAKE_PRIVATE, count, nullptr, nullptr, 0);
+#endif
+        }
+
+        std::atomic<int> state_;
+};
+
+// short name of a lock type, as in lockKindName()
+template <typename Lock>
+inline const char* lockName() {
+    return Lock::name();
+}
+
+template <>
+inline const char* lockName<std::mutex>() {
+    return "mutex";
+}
+
+/*
+ * Condition variable to pair with Lock: std::condition_variable only
+ * takes std::mutex, std::condition_variable_any takes any lock.
+ */
+template <typename Lock>
+struct ConditionFor {
+    typedef std::condition_variable_any type;
+};
+
+template <>
+struct ConditionFor<std::mutex> {
+    typedef std::condition_variable type;
+};
+
+#endif
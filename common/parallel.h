@@ -0,0 +1,201 @@
+#ifndef _PARALLEL_H
+#define _PARALLEL_H
+
+#include <algorithm>
+#include <cstdint>
+#include <new>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+#include "itasksys.h"
+
+/*
+ * Templated front end over ITaskSystem for loop bodies given as
+ * lambdas.  Every call site instantiates its own FunctionTask, whose
+ * runTaskRange() runs the body over a whole chunk of indices in a plain
+ * loop: the pool makes one virtual call per chunk and the compiler can
+ * inline and vectorize the body across the chunk.
+ *
+ * One task id is one loop index, so the launches default to guided
+ * chunks; pass Schedule() to use the pool's own policy instead, for
+ * example lazy splitting.
+ */
+
+/*
+ * IRunnable calling `f(i)` for each task id i.  Each chunk runs on a
+ * local copy of the callable: stores through captured pointers could
+ * otherwise alias the task object and force the captures to be
+ * reloaded on every iteration.  F must therefore be copy constructible.
+ */
+template <typename F>
+class FunctionTask final: public IRunnable {
+    public:
+        template <typename G>
+        explicit FunctionTask(G&& f): f_(std::forward<G>(f)) {}
+
+        void runTask(int task_id, int num_total_tasks) override {
+            f_(task_id);
+        }
+
+        void runTaskRange(int begin, int end, int num_total_tasks) override {
+            F f(f_);
+            for (int i = begin; i < end; i++) {
+                f(i);
+            }
+        }
+
+    private:
+        F f_;
+};
+
+/*
+ * Runs f(0) ... f(n-1) on `pool` and returns when all calls are done.
+ */
+template <typename F>
+inline void parallel_for(ITaskSystem& pool, int n, F&& f,
+                         const Schedule& schedule = Schedule(SCHEDULE_GUIDED)) {
+    FunctionTask<typename std::decay<F>::type> task(std::forward<F>(f));
+    pool.run(&task, n, schedule);
+}
+
+/*
+ * Handle of a launchAsync() launch.  It owns the copy of the loop body
+ * the launch runs, so destroying or reassigning it waits for the
+ * launch first.  id() is the TaskID to use in dependency lists.
+ */
+class AsyncLaunch {
+    public:
+        AsyncLaunch(): pool_(nullptr), task_(nullptr), id_(-1) {}
+        AsyncLaunch(ITaskSystem* pool, IRunnable* task, TaskID id): pool_(pool), task_(task), id_(id) {}
+        AsyncLaunch(AsyncLaunch&& other): pool_(other.pool_), task_(other.task_), id_(other.id_) {
+            other.task_ = nullptr;
+        }
+        AsyncLaunch& operator=(AsyncLaunch&& other) {
+            if (this != &other) {
+                release();
+                pool_ = other.pool_;
+                task_ = other.task_;
+                id_ = other.id_;
+                other.task_ = nullptr;
+            }
+            return *this;
+        }
+        AsyncLaunch(const AsyncLaunch&) = delete;
+        AsyncLaunch& operator=(const AsyncLaunch&) = delete;
+        ~AsyncLaunch() { release(); }
+
+        TaskID id() const { return id_; }
+
+        // blocks until the launch is done
+        void wait() {
+            if (task_ != nullptr) {
+                pool_->wait(id_);
+            }
+        }
+
+    private:
+        void release() {
+            if (task_ != nullptr) {
+                pool_->wait(id_);
+                delete task_;
+                task_ = nullptr;
+            }
+        }
+
+        ITaskSystem* pool_;
+        IRunnable* task_;
+        TaskID id_;
+};
+
+/*
+ * Launches f(0) ... f(n-1) on `pool` once every launch in `deps` is
+ * done, like runAsyncWithDeps().  The body is moved or copied into the
+ * returned handle, so lambdas capturing locals by value are safe.
+ */
+template <typename F>
+inline AsyncLaunch launchAsync(ITaskSystem& pool, int n, F&& f, const std::vector<TaskID>& deps,
+                               const Schedule& schedule = Schedule(SCHEDULE_GUIDED)) {
+    IRunnable* task = new FunctionTask<typename std::decay<F>::type>(std::forward<F>(f));
+    TaskID id = pool.runAsyncWithDeps(task, n, deps, schedule);
+    return AsyncLaunch(&pool, task, id);
+}
+
+/*
+ * One T per cache line, so partial results written by different workers
+ * never share a line.  The storage is aligned by hand because C++11
+ * allocators ignore over-alignment.
+ */
+template <typename T>
+class PaddedPartials {
+    public:
+        PaddedPartials(int count, const T& init): count_(count) {
+            raw_ = new char[count * sizeof(Slot) + alignof(Slot)];
+            uintptr_t addr = reinterpret_cast<uintptr_t>(raw_);
+            addr = (addr + alignof(Slot) - 1) & ~(uintptr_t)(alignof(Slot) - 1);
+            slots_ = reinterpret_cast<Slot*>(addr);
+            for (int i = 0; i < count_; i++) {
+                new (&slots_[i]) Slot(init);
+            }
+        }
+        ~PaddedPartials() {
+            for (int i = 0; i < count_; i++) {
+                slots_[i].~Slot();
+            }
+            delete[] raw_;
+        }
+        PaddedPartials(const PaddedPartials&) = delete;
+        PaddedPartials& operator=(const PaddedPartials&) = delete;
+
+        T& operator[](int i) { return slots_[i].value; }
+
+    private:
+        struct alignas(64) Slot {
+            T value;
+            explicit Slot(const T& v): value(v) {}
+        };
+
+        char* raw_;
+        Slot* slots_;
+        int count_;
+};
+
+/*
+ * Folds map(0) ... map(n-1) with `combine`, starting from `identity`, in
+ * a single launch.  The index space is cut into `num_blocks` contiguous
+ * blocks; each task folds one block into a local accumulator and stores
+ * it in its padded partial, then the caller combines the partials
+ * pairwise in a tree.  The blocking does not depend on the schedule, so
+ * the result is the same on every run even for floating-point sums.
+ *
+ * combine(a, b) may take `a` by value and return it, which lets large
+ * accumulators such as vectors be updated in place.
+ */
+template <typename T, typename Map, typename Combine>
+inline T parallelReduce(ITaskSystem& pool, int n, const T& identity, Map map, Combine combine,
+                        int num_blocks = 64) {
+    if (n <= 0) {
+        return identity;
+    }
+    int blocks = std::max(1, std::min(n, num_blocks));
+    PaddedPartials<T> partials(blocks, identity);
+
+    parallel_for(pool, blocks, [&](int block) {
+        int begin = (int)((int64_t)n * block / blocks);
+        int end = (int)((int64_t)n * (block + 1) / blocks);
+        T acc = identity;
+        for (int i = begin; i < end; i++) {
+            acc = combine(std::move(acc), map(i));
+        }
+        partials[block] = std::move(acc);
+    }, Schedule(SCHEDULE_DYNAMIC));
+
+    for (int stride = 1; stride < blocks; stride *= 2) {
+        for (int b = 0; b + stride < blocks; b += 2 * stride) {
+            partials[b] = combine(std::move(partials[b]), partials[b + stride]);
+        }
+    }
+    return std::move(partials[0]);
+}
+
+#endif
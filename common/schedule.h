@@ -0,0 +1,67 @@
+#ifndef _SCHEDULE_H
+#define _SCHEDULE_H
+
+#include <algorithm>
+#include <atomic>
+
+#include "itasksys.h"
+
+/*
+ * Chunk sizes for the Schedule of a bulk launch, shared by the engines
+ * of both parts.
+ */
+
+/*
+ * Number of ids a thread claims next when `remaining` of the launch's
+ * `total` ids are still unclaimed and `threads` threads share it.
+ * SCHEDULE_AUTO is treated as dynamic with chunk 1 here; engines with a
+ * policy of their own check for it first.
+ */
+inline int scheduleChunk(const Schedule& schedule, int remaining, int total, int threads) {
+    int chunk = std::max(schedule.chunk, 1);
+    threads = std::max(threads, 1);
+    if (schedule.kind == SCHEDULE_STATIC && schedule.chunk <= 0) {
+        chunk = (total + threads - 1) / threads;
+    } else if (schedule.kind == SCHEDULE_GUIDED) {
+        chunk = std::max(chunk, (remaining + threads - 1) / threads);
+    }
+    return std::max(1, std::min(chunk, remaining));
+}
+
+/*
+ * Claims the next chunk [begin, end) from the shared counter `next`.
+ * Returns false once every id has been claimed.
+ */
+inline bool claimChunk(std::atomic<int>& next, const Schedule& schedule, int total, int threads,
+                       int& begin, int& end) {
+    if (schedule.kind != SCHEDULE_GUIDED) {
+        // fixed chunk size: one fetch_add, no retry loop
+        int chunk = scheduleChunk(schedule, total, total, threads);
+        begin = next.fetch_add(chunk, std::memory_order_relaxed);
+        end = std::min(begin + chunk, total);
+        return begin < total;
+    }
+    begin = next.load(std::memory_order_relaxed);
+    while (begin < total) {
+        end = begin + scheduleChunk(schedule, total - begin, total, threads);
+        if (next.compare_exchange_weak(begin, end, std::memory_order_relaxed)) {
+            return true;
+        }
+    }
+    return false;
+}
+
+/*
+ * SCHEDULE_STATIC without a shared counter: thread `thread` of
+ * `threads` runs blocks thread, thread + threads, thread + 2 * threads,
+ * ... calling f(begin, end) for each.
+ */
+template <typename F>
+inline void forEachStaticChunk(const Schedule& schedule, int total, int threads, int thread, F f) {
+    int chunk = scheduleChunk(schedule, total, total, threads);
+    for (long long begin = (long long)thread * chunk; begin < total; begin += (long long)threads * chunk) {
+        f((int)begin, (int)std::min<long long>(begin + chunk, total));
+    }
+}
+
+#endif
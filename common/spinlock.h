@@ -0,0 +1,63 @@
+#ifndef _SPINLOCK_H
+#define _SPINLOCK_H
+
+#include <atomic>
+#include <thread>
+
+/*
+ * Spin-wait hint for polling loops: lets the sibling hyperthread run and
+ * saves power while a thread waits for a value to change.
+ */
+static inline void cpuRelax() {
+#if defined(__x86_64__) || defined(__i386__)
+    __builtin_ia32_pause();
+#elif defined(__aarch64__) || defined(__arm__)
+    asm volatile("yield" ::: "memory");
+#else
+    std::this_thread::yield();
+#endif
+}
+
+/*
+ * SpinLock: test-and-test-and-set lock for very short critical sections
+ * where a std::mutex would be larger than the data it protects.  After
+ * kSpinsBeforeYield polls the waiter yields its time slice, so a holder
+ * that was preempted on an oversubscribed machine gets to run.
+ */
+struct SpinLock {
+    static const int kSpinsBeforeYield = 64;
+    std::atomic<bool> locked = {false};
+    void lock() {
+        int spins = 0;
+        while (locked.exchange(true, std::memory_order_acquire)) {
+            while (locked.load(std::memory_order_relaxed)) {
+                if (++spins < kSpinsBeforeYield) {
+                    cpuRelax();
+                } else {
+                    std::this_thread::yield();
+                }
+            }
+        }
+    }
+    void unlock() {
+        locked.store(false, std::memory_order_release);
+    }
+};
+
+/*
+ * Polls `done` until it returns true, with the same back-off as
+ * SpinLock: cpuRelax() between polls, then yielding the time slice.
+ */
+template <typename Done>
+inline void spinUntil(const Done& done) {
+    int spins = 0;
+    while (!done()) {
+        if (++spins < SpinLock::kSpinsBeforeYield) {
+            cpuRelax();
+        } else {
+            std::this_thread::yield();
+        }
+    }
+}
+
+#endif
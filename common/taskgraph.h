@@ -0,0 +1,205 @@
+#ifndef _TASKGRAPH_H
+#define _TASKGRAPH_H
+
+#include <algorithm>
+#include <vector>
+
+#include "itasksys.h"
+
+/*
+ * Task graph capture and replay.  A TaskGraphRecorder stands in for a
+ * task system while a pipeline submits its launches; finish() turns the
+ * recorded calls into an immutable TaskGraph, which
+ * ITaskSystem::runGraph() launches as a whole, as often as needed.
+ */
+
+// runner of the barrier and exit nodes the recorder adds
+class EmptyTask: public IRunnable {
+    public:
+        void runTask(int task_id, int num_total_tasks) {}
+};
+
+inline IRunnable* emptyTask() {
+    static EmptyTask task;
+    return &task;
+}
+
+/*
+ * One recorded bulk task launch.  Successors and dependencies are
+ * slices of the graph's edge arrays.
+ */
+struct TaskGraphNode {
+    IRunnable* runner;
+    int numTasks;
+    Schedule schedule;
+    int firstSuccessor, numSuccessors;
+    int firstDep, numDeps;
+    long long bottomLevel;  // tasks on the longest path from here to the exit node
+};
+
+/*
+ * TaskGraph: validated launches in topological order.  Capture order is
+ * already one, since a launch can only depend on launches recorded
+ * before it.  The last node is the only sink, so it is done exactly when
+ * the whole graph is; finish() appends an empty exit node when the
+ * recorded launches have several sinks.
+ */
+class TaskGraph {
+    public:
+        int size() const { return (int)nodes_.size(); }
+        const TaskGraphNode& node(int i) const { return nodes_[i]; }
+        // node indices of the successors and dependencies of node i
+        const int* successors(int i) const { return successors_.data() + nodes_[i].firstSuccessor; }
+        const int* deps(int i) const { return deps_.data() + nodes_[i].firstDep; }
+        // nodes without dependencies inside the graph
+        const std::vector<int>& sources() const { return sources_; }
+        int numEdges() const { return (int)deps_.size(); }
+
+    private:
+        friend class TaskGraphRecorder;
+        TaskGraph() {}  // graphs come from TaskGraphRecorder::finish()
+
+        std::vector<TaskGraphNode> nodes_;
+        std::vector<int> successors_;
+        std::vector<int> deps_;
+        std::vector<int> sources_;
+};
+
+/*
+ * TaskGraphRecorder: an ITaskSystem that runs nothing and records the
+ * launches submitted to it.  The TaskIDs it hands out are node indices
+ * and are only meaningful as dependencies of later recorded launches;
+ * like runAsyncWithDeps(), deps that do not name an earlier launch are
+ * ignored.  sync() and run() record a barrier: launches recorded after
+ * it depend on everything recorded before it.
+ */
+class TaskGraphRecorder: public ITaskSystem {
+    public:
+        TaskGraphRecorder(): ITaskSystem(1), barrier(-1) {}
+        const char* name() { return "Task Graph Recorder"; }
+
+        void run(IRunnable* runnable, int num_total_tasks, const Schedule& schedule = Schedule()) {
+            runAsyncWithDeps(runnable, num_total_tasks, std::vector<TaskID>(), schedule);
+            sync();
+        }
+
+        TaskID runAsyncWithDeps(IRunnable* runnable, int num_total_tasks,
+                                const std::vector<TaskID>& deps,
+                                const Schedule& schedule = Schedule()) {
+            Launch launch;
+            launch.runner = runnable;
+            launch.numTasks = num_total_tasks;
+            launch.schedule = schedule;
+            int id = (int)launches.size();
+            for (TaskID dep : deps) {
+                if (dep >= 0 && dep < id) {
+                    launch.deps.push_back((int)dep);
+                }
+            }
+            if (barrier >= 0) {
+                launch.deps.push_back(barrier);
+            }
+            std::sort(launch.deps.begin(), launch.deps.end());
+            launch.deps.erase(std::unique(launch.deps.begin(), launch.deps.end()), launch.deps.end());
+            launches.push_back(launch);
+            return id;
+        }
+
+        void sync() {
+            if (launches.empty() || (barrier >= 0 && barrier == (int)launches.size() - 1)) {
+                return;
+            }
+            std::vector<TaskID> sinks = currentSinks();
+            barrier = -1;
+            if (sinks.size() == 1) {
+                barrier = (int)sinks[0];
+            } else {
+                barrier = (int)runAsyncWithDeps(emptyTask(), 0, sinks);
+            }
+        }
+
+        // the recorded launches as a graph; the recorder can be reused
+        TaskGraph finish() {
+            std::vector<TaskID> sinks = currentSinks();
+            if (sinks.size() != 1) {
+                barrier = -1;
+                runAsyncWithDeps(emptyTask(), 0, sinks);
+            }
+
+            TaskGraph graph;
+            int n = (int)launches.size();
+            graph.nodes_.resize(n);
+            std::vector<int> outDegree(n, 0);
+            for (int i = 0; i < n; i++) {
+                TaskGraphNode& node = graph.nodes_[i];
+                node.runner = launches[i].runner;
+                node.numTasks = launches[i].numTasks;
+                node.schedule = launches[i].schedule;
+                node.firstDep = (int)graph.deps_.size();
+                node.numDeps = (int)launches[i].deps.size();
+                for (int dep : launches[i].deps) {
+                    graph.deps_.push_back(dep);
+                    outDegree[dep]++;
+                }
+                if (node.numDeps == 0) {
+                    graph.sources_.push_back(i);
+                }
+            }
+            int offset = 0;
+            for (int i = 0; i < n; i++) {
+                graph.nodes_[i].firstSuccessor = offset;
+                graph.nodes_[i].numSuccessors = 0;
+                offset += outDegree[i];
+            }
+            graph.successors_.resize(offset);
+            for (int i = 0; i < n; i++) {
+                for (int dep : launches[i].deps) {
+                    TaskGraphNode& pred = graph.nodes_[dep];
+                    graph.successors_[pred.firstSuccessor + pred.numSuccessors++] = i;
+                }
+            }
+            // reverse topological order: successors are final first
+            for (int i = n - 1; i >= 0; i--) {
+                TaskGraphNode& node = graph.nodes_[i];
+                long long below = 0;
+                for (int k = 0; k < node.numSuccessors; k++) {
+                    below = std::max(below, graph.nodes_[graph.successors_[node.firstSuccessor + k]].bottomLevel);
+                }
+                node.bottomLevel = std::max(node.numTasks, 1) + below;
+            }
+
+            launches.clear();
+            barrier = -1;
+            return graph;
+        }
+
+    private:
+        struct Launch {
+            IRunnable* runner;
+            int numTasks;
+            Schedule schedule;
+            std::vector<int> deps;
+        };
+
+        // launches no other recorded launch depends on
+        std::vector<TaskID> currentSinks() {
+            std::vector<bool> hasSuccessor(launches.size(), false);
+            for (const Launch& launch : launches) {
+                for (int dep : launch.deps) {
+                    hasSuccessor[dep] = true;
+                }
+            }
+            std::vector<TaskID> sinks;
+            for (size_t i = 0; i < launches.size(); i++) {
+                if (!hasSuccessor[i]) {
+                    sinks.push_back((TaskID)i);
+                }
+            }
+            return sinks;
+        }
+
+        std::vector<Launch> launches;
+        int barrier;    // launch every later launch depends on, -1 if none
+};
+
+#endif
@@ -0,0 +1,373 @@
+#ifndef _TOPOLOGY_H
+#define _TOPOLOGY_H
+
+#include <algorithm>
+#include <cerrno>
+#include <climits>
+#include <cmath>
+#include <cstdlib>
+#include <fstream>
+#include <map>
+#include <sstream>
+#include <stdio.h>
+#include <string>
+#include <thread>
+#include <utility>
+#include <vector>
+
+#ifdef __linux__
+#include <pthread.h>
+#include <sched.h>
+#endif
+
+#include "itasksys.h"
+
+/*
+ * CPU topology and worker placement.  The topology is read from /sys on
+ * Linux; elsewhere every hardware thread is treated as its own core and
+ * pinning is a no-op.
+ */
+
+/*
+ * Parses all of `text`, give or take surrounding whitespace, as a
+ * decimal integer or a floating-point number.  Both return false and leave
+ * `value` alone when anything else is left over or the value does not
+ * fit.
+ */
+inline bool parseInt(const std::string& text, int& value) {
+    const char* begin = text.c_str();
+    char* end;
+    errno = 0;
+    long parsed = strtol(begin, &end, 10);
+    while (end != begin && (*end == ' ' || *end == '\t' || *end == '\n')) {
+        end++;
+    }
+    if (end == begin || *end != '\0' || errno == ERANGE || parsed < INT_MIN || parsed > INT_MAX) {
+        return false;
+    }
+    value = (int)parsed;
+    return true;
+}
+
+inline bool parseDouble(const std::string& text, double& value) {
+    const char* begin = text.c_str();
+    char* end;
+    errno = 0;
+    double parsed = strtod(begin, &end);
+    while (end != begin && (*end == ' ' || *end == '\t' || *end == '\n')) {
+        end++;
+    }
+    if (end == begin || *end != '\0' || errno == ERANGE) {
+        return false;
+    }
+    value = parsed;
+    return true;
+}
+
+/*
+ * Parses a kernel cpu list such as "0-3,8,10-11".  Returns an empty
+ * vector if the list is malformed.
+ */
+inline std::vector<int> parseCpuList(const std::string& list) {
+    // cpu_set_t holds 1024 cpus; the cap also keeps a typo like
+    // "0-99999999" from filling memory
+    const int maxCpu = 1 << 16;
+    std::vector<int> cpus;
+    std::stringstream ss(list);
+    std::string item;
+    while (std::getline(ss, item, ',')) {
+        if (item.empty()) {
+            continue;
+        }
+        size_t dash = item.find('-');
+        int first, last;
+        if (!parseInt(item.substr(0, dash), first)) {
+            return std::vector<int>();
+        }
+        last = first;
+        if (dash != std::string::npos && !parseInt(item.substr(dash + 1), last)) {
+            return std::vector<int>();
+        }
+        if (first < 0 || last < first || last >= maxCpu) {
+            return std::vector<int>();
+        }
+        for (int cpu = first; cpu <= last; cpu++) {
+            cpus.push_back(cpu);
+        }
+    }
+    return cpus;
+}
+
+struct CpuInfo {
+    int cpu;        // kernel cpu number
+    int core;       // dense index of the physical core
+    int llc;        // dense index of the last-level cache domain
+    int smt;        // position among the hardware threads of its core
+};
+
+class CpuTopology {
+    public:
+        // detected once, on first use
+        static const CpuTopology& get() {
+            static CpuTopology topology;
+            return topology;
+        }
+
+        const std::vector<CpuInfo>& cpus() const { return cpus_; }
+        int numCores() const { return numCores_; }
+        int numLlcs() const { return numLlcs_; }
+        // cgroup CPU bandwidth limit in CPUs, 0 when unlimited
+        double cpuQuota() const { return cpuQuota_; }
+
+        // one worker per usable CPU, capped by the cgroup quota
+        int defaultThreadCount() const {
+            int n = (int)cpus_.size();
+            if (cpuQuota_ > 0) {
+                n = std::min(n, (int)std::ceil(cpuQuota_));
+            }
+            return std::max(n, 1);
+        }
+
+        /*
+         * CPU for each of `num_threads` workers, or an empty vector when
+         * workers are left to the kernel.  Compact fills the hardware
+         * threads of a core, then the cores of an LLC domain, then the
+         * next domain.  Scatter puts consecutive workers on different
+         * LLC domains and cores and only doubles up on SMT siblings once
+         * every core has a worker.  Workers beyond the number of CPUs
+         * wrap around.
+         */
+        std::vector<int> placement(PinPolicy policy, int num_threads, const std::vector<int>& cpu_list) const {
+            std::vector<int> order;
+            if (policy == PIN_EXPLICIT) {
+                order = cpu_list;
+            } else if (policy == PIN_COMPACT || policy == PIN_SCATTER) {
+                std::vector<std::pair<std::vector<int>, int> > keyed;
+                std::map<int, int> coresSeen;   // core -> rank of the core within its LLC domain
+                std::vector<int> coresPerLlc(numLlcs_, 0);
+                for (const CpuInfo& c : cpus_) {
+                    if (coresSeen.count(c.core) == 0) {
+                        coresSeen[c.core] = coresPerLlc[c.llc]++;
+                    }
+                    std::vector<int> key;
+                    if (policy == PIN_COMPACT) {
+                        key = {c.llc, c.core, c.smt};
+                    } else {
+                        key = {c.smt, coresSeen[c.core], c.llc};
+                    }
+                    keyed.push_back(std::make_pair(key, c.cpu));
+                }
+                std::sort(keyed.begin(), keyed.end());
+                for (size_t i = 0; i < keyed.size(); i++) {
+                    order.push_back(keyed[i].second);
+                }
+            }
+            std::vector<int> result;
+            if (order.empty()) {
+                return result;
+            }
+            for (int i = 0; i < num_threads; i++) {
+                result.push_back(order[i % order.size()]);
+            }
+            return result;
+        }
+
+        void print() const {
+            printf("CPU topology: %d cpus, %d cores, %d LLC domains", (int)cpus_.size(), numCores_, numLlcs_);
+            if (cpuQuota_ > 0) {
+                printf(", cgroup quota %.2f cpus", cpuQuota_);
+            }
+            printf(", default %d threads\n", defaultThreadCount());
+        }
+
+    private:
+        CpuTopology(): numCores_(0), numLlcs_(0), cpuQuota_(0) {
+            std::vector<int> allowed;
+#ifdef __linux__
+            cpu_set_t set;
+            CPU_ZERO(&set);
+            if (sched_getaffinity(0, sizeof(set), &set) == 0) {
+                for (int cpu = 0; cpu < CPU_SETSIZE; cpu++) {
+                    if (CPU_ISSET(cpu, &set)) {
+                        allowed.push_back(cpu);
+                    }
+                }
+            }
+#endif
+            if (allowed.empty()) {
+                int n = std::max(1u, std::thread::hardware_concurrency());
+                for (int cpu = 0; cpu < n; cpu++) {
+                    allowed.push_back(cpu);
+                }
+            }
+
+            std::map<std::pair<int, int>, int> cores;  // (package, core_id) -> dense index
+            std::map<int, int> llcs;                    // first cpu sharing the LLC -> dense index
+            bool parsed = true;
+            for (int cpu : allowed) {
+                std::string base = "/sys/devices/system/cpu/cpu" + std::to_string(cpu);
+                int package, coreId, llcKey;
+                std::string siblingList = readLine(base + "/topology/thread_siblings_list");
+                std::vector<int> siblings = parseCpuList(siblingList);
+                if (!readInt(base + "/topology/physical_package_id", 0, package) ||
+                    !readInt(base + "/topology/core_id", cpu, coreId) ||
+                    (siblings.empty() && !siblingList.empty()) ||
+                    !lastLevelCacheKey(base, package, llcKey)) {
+                    parsed = false;
+                    break;
+                }
+
+                CpuInfo info;
+                info.cpu = cpu;
+                std::pair<int, int> coreKey(package, coreId);
+                if (cores.count(coreKey) == 0) {
+                    int index = (int)cores.size();
+                    cores[coreKey] = index;
+                }
+                info.core = cores[coreKey];
+                info.smt = (int)(std::find(siblings.begin(), siblings.end(), cpu) - siblings.begin());
+                if (info.smt == (int)siblings.size()) {
+                    info.smt = 0;
+                }
+                if (llcs.count(llcKey) == 0) {
+                    int index = (int)llcs.size();
+                    llcs[llcKey] = index;
+                }
+                info.llc = llcs[llcKey];
+                cpus_.push_back(info);
+            }
+            if (!parsed) {
+                // /sys says something we cannot read: same as no /sys at all
+                cpus_.clear();
+                cores.clear();
+                llcs.clear();
+                llcs[0] = 0;
+                for (int cpu : allowed) {
+                    CpuInfo info;
+                    info.cpu = cpu;
+                    info.core = (int)cpus_.size();
+                    info.llc = 0;
+                    info.smt = 0;
+                    cpus_.push_back(info);
+                    cores[std::make_pair(0, cpu)] = info.core;
+                }
+            }
+            numCores_ = (int)cores.size();
+            numLlcs_ = (int)llcs.size();
+            cpuQuota_ = readCgroupQuota();
+        }
+
+        static std::string readLine(const std::string& path) {
+            std::ifstream in(path.c_str());
+            std::string line;
+            std::getline(in, line);
+            return line;
+        }
+
+        // `fallback` for a missing or empty file; false if the file does not parse
+        static bool readInt(const std::string& path, int fallback, int& value) {
+            std::string line = readLine(path);
+            if (line.empty()) {
+                value = fallback;
+                return true;
+            }
+            return parseInt(line, value);
+        }
+
+        // lowest cpu sharing the highest-level data or unified cache;
+        // cpus without cache information get one domain per package
+        static bool lastLevelCacheKey(const std::string& base, int package, int& key) {
+            int bestLevel = -1;
+            key = -1 - package;
+            for (int index = 0; ; index++) {
+                std::string dir = base + "/cache/index" + std::to_string(index);
+                std::string levelLine = readLine(dir + "/level");
+                int level;
+                if (levelLine.empty()) {
+                    break;
+                }
+                if (!parseInt(levelLine, level)) {
+                    return false;
+                }
+                if (readLine(dir + "/type") == "Instruction" || level <= bestLevel) {
+                    continue;
+                }
+                std::string sharedList = readLine(dir + "/shared_cpu_list");
+                std::vector<int> shared = parseCpuList(sharedList);
+                if (shared.empty() && !sharedList.empty()) {
+                    return false;
+                }
+                if (!shared.empty()) {
+                    bestLevel = level;
+                    key = *std::min_element(shared.begin(), shared.end());
+                }
+            }
+            return true;
+        }
+
+        // cgroup v2 cpu.max ("max 100000" or "<quota> <period>"), then v1;
+        // anything that does not parse counts as no limit
+        static double readCgroupQuota() {
+            std::string max = readLine("/sys/fs/cgroup/cpu.max");
+            if (!max.empty()) {
+                std::stringstream ss(max);
+                std::string quotaText, periodText, rest;
+                double quota, period;
+                ss >> quotaText >> periodText >> rest;
+                if (quotaText != "max" && rest.empty() && parseDouble(quotaText, quota) &&
+                    parseDouble(periodText, period) && quota > 0 && period > 0) {
+                    return quota / period;
+                }
+                return 0;
+            }
+            const char* dirs[] = {"/sys/fs/cgroup/cpu", "/sys/fs/cgroup/cpu,cpuacct"};
+            for (const char* dir : dirs) {
+                std::string d(dir);
+                int quota, period;
+                if (readInt(d + "/cpu.cfs_quota_us", -1, quota) && readInt(d + "/cpu.cfs_period_us", 0, period) &&
+                    quota > 0 && period > 0) {
+                    return (double)quota / period;
+                }
+            }
+            return 0;
+        }
+
+        std::vector<CpuInfo> cpus_;
+        int numCores_;
+        int numLlcs_;
+        double cpuQuota_;
+};
+
+/*
+ * Restricts `thread` to run on `cpu`.  Returns false if the platform or
+ * the kernel refused.
+ */
+inline bool pinThread(std::thread& thread, int cpu) {
+#ifdef __linux__
+    if (cpu < 0 || cpu >= CPU_SETSIZE) {
+        return false;
+    }
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    CPU_SET(cpu, &set);
+    return pthread_setaffinity_np(thread.native_handle(), sizeof(set), &set) == 0;
+#else
+    return false;
+#endif
+}
+
+/*
+ * Pins workers[i] to placement[i]; does nothing for an empty placement.
+ */
+inline void pinWorkers(std::vector<std::thread>& workers, const std::vector<int>& placement) {
+    for (size_t i = 0; i < workers.size() && i < placement.size(); i++) {
+        pinThread(workers[i], placement[i]);
+    }
+}
+
+// number of workers for a pool constructed with `num_threads`
+inline int resolveThreadCount(int num_threads) {
+    return num_threads > 0 ? num_threads : CpuTopology::get().defaultThreadCount();
+}
+
+#endif
@@ -0,0 +1,113 @@
+#ifndef _WORKERSTATS_H
+#define _WORKERSTATS_H
+
+#include <atomic>
+#include <chrono>
+
+#include "itasksys.h"
+
+/*
+ * Live side of ITaskSystem::getStats().  Every worker slot owns one
+ * WorkerCounters and only the thread in the slot adds to it, so an
+ * update is a relaxed load and store on a line no other worker writes,
+ * not a locked read-modify-write.  Engines pass a null WorkerCounters*
+ * when options.stats is off, which makes every counting site one
+ * untaken branch and keeps the clock reads out of the hot paths.
+ */
+
+inline const char* workerStatName(WorkerStat stat) {
+    static const char* names[NUM_WORKER_STATS] = {
+        "tasks", "chunks", "steal attempts", "steals", "wakeups",
+        "busy ns", "spin ns", "parked ns", "lock wait ns",
+    };
+    return names[stat];
+}
+
+// steady clock in nanoseconds
+inline long long statNanos() {
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(
+        std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+class WorkerCounters {
+    public:
+        WorkerCounters() {
+            for (int i = 0; i < NUM_WORKER_STATS; i++) {
+                values_[i].store(0, std::memory_order_relaxed);
+            }
+        }
+
+        // only the thread in the counters' slot may add
+        void add(WorkerStat stat, long long n = 1) {
+            values_[stat].store(values_[stat].load(std::memory_order_relaxed) + n, std::memory_order_relaxed);
+        }
+        long long get(WorkerStat stat) const {
+            return values_[stat].load(std::memory_order_relaxed);
+        }
+        WorkerStats snapshot() const {
+            WorkerStats stats;
+            for (int i = 0; i < NUM_WORKER_STATS; i++) {
+                stats.values[i] = values_[i].load(std::memory_order_relaxed);
+            }
+            return stats;
+        }
+
+    private:
+        std::atomic<long long> values_[NUM_WORKER_STATS];
+        char pad_[64];  // padded by hand, C++11 operator new ignores alignas
+};
+
+/*
+ * Adds the time from construction to destruction to `stat`, or does
+ * nothing if `counters` is null.
+ */
+class StatTimer {
+    public:
+        StatTimer(WorkerCounters* counters, WorkerStat stat)
+            : counters_(counters), stat_(stat), start_(counters != nullptr ? statNanos() : 0) {}
+        ~StatTimer() {
+            if (counters_ != nullptr) {
+                counters_->add(stat_, statNanos() - start_);
+            }
+        }
+
+    private:
+        WorkerCounters* counters_;
+        WorkerStat stat_;
+        long long start_;
+};
+
+/*
+ * lock.lock(), adding the time spent waiting to STAT_LOCK_WAIT_NS when
+ * the lock was not free.  L is any Lockable, a std::unique_lock too.
+ */
+template <typename L>
+inline void lockCounted(L& lock, WorkerCounters* counters) {
+    if (counters == nullptr) {
+        lock.lock();
+        return;
+    }
+    if (lock.try_lock()) {
+        return;
+    }
+    long long start = statNanos();
+    lock.lock();
+    counters->add(STAT_LOCK_WAIT_NS, statNanos() - start);
+}
+
+// std::lock_guard taking the lock with lockCounted()
+template <typename L>
+class CountedLockGuard {
+    public:
+        CountedLockGuard(L& lock, WorkerCounters* counters): lock_(lock) {
+            lockCounted(lock_, counters);
+        }
+        ~CountedLockGuard() { lock_.unlock(); }
+        CountedLockGuard(const CountedLockGuard&) = delete;
+        CountedLockGuard& operator=(const CountedLockGuard&) = delete;
+
+    private:
+        L& lock_;
+};
+
+#endif
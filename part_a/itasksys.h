@@ -1,9 +1,173 @@
 #ifndef _ITASKSYS_H
 #define _ITASKSYS_H
+#include <chrono>
+#include <functional>
 #include <vector>
 
 typedef int TaskID;
 
+/*
+  How pool workers are pinned to CPUs, see CpuTopology::placement() in
+  common/topology.h.
+ */
+enum PinPolicy {
+    PIN_NONE,       // leave placement to the kernel
+    PIN_COMPACT,    // fill SMT siblings, then cores of one LLC domain, then the next domain
+    PIN_SCATTER,    // spread over LLC domains and cores before using SMT siblings
+    PIN_EXPLICIT,   // worker i runs on pin_cpus[i % pin_cpus.size()]
+};
+
+/*
+  Optional knobs for the thread pool implementations.  Engines ignore
+  the options that do not apply to them.
+ */
+struct TaskSystemOptions {
+    bool work_stealing;     // per-worker deques instead of one shared ready queue
+    bool verbose;           // print scheduler counters when the task system is destroyed
+    int max_spin;           // upper bound on idle polls before a worker parks, 0 parks at once
+    bool help_on_sync;      // sync() runs ready tasks on the calling thread instead of only sleeping
+    bool critical_path;     // dispatch ready launches longest remaining path first instead of FIFO
+    bool lazy_split;        // hand out whole launches, split them only while a worker is idle; implies work_stealing
+    PinPolicy pin_policy;   // worker placement
+    std::vector<int> pin_cpus;  // cpu list for PIN_EXPLICIT
+    bool elastic;           // sleeping pool starts min_threads workers and adds or retires workers with the load
+    int min_threads;        // elastic pool: workers kept while idle, at least 1
+    int grow_delay_us;      // elastic pool: how long ready work may wait with every worker busy before one is added
+    int idle_timeout_us;    // elastic pool: how long a parked worker waits for work before it exits
+    int priority_aging_us;  // a ready launch competes one priority class higher per period it waited, 0 never
+    bool stats;             // workers keep the counters ITaskSystem::getStats() reports
+    TaskSystemOptions(): work_stealing(false), verbose(false), max_spin(1 << 12), help_on_sync(true),
+                         critical_path(false), lazy_split(false), pin_policy(PIN_NONE), elastic(false),
+                         min_threads(1), grow_delay_us(500), idle_timeout_us(50000), priority_aging_us(10000),
+                         stats(false) {}
+};
+
+/*
+  How the task ids of one bulk launch are handed out to threads, after
+  OpenMP's schedule clause.  `chunk` is the number of consecutive ids a
+  thread claims at once; 0 picks the default of the kind.  See
+  scheduleChunk() in common/schedule.h.
+ */
+enum ScheduleKind {
+    SCHEDULE_AUTO,      // the engine's own policy
+    SCHEDULE_STATIC,    // blocks of `chunk` ids fixed up front, default one block per thread
+    SCHEDULE_DYNAMIC,   // threads claim `chunk` ids at a time, default 1
+    SCHEDULE_GUIDED,    // claims shrink with the unclaimed ids left: remaining / threads, at least `chunk`
+};
+
+/*
+  Priority class of a launch.  Task systems with a ready queue hand out
+  ready launches of a higher class first; see priority_aging_us for how
+  lower classes avoid starving.
+ */
+enum LaunchPriority {
+    PRIORITY_LOW,
+    PRIORITY_NORMAL,
+    PRIORITY_HIGH,
+};
+
+const int NUM_PRIORITIES = 3;
+
+struct Schedule {
+    ScheduleKind kind;
+    int chunk;
+    LaunchPriority priority;
+    Schedule(ScheduleKind _kind = SCHEDULE_AUTO, int _chunk = 0, LaunchPriority _priority = PRIORITY_NORMAL)
+        : kind(_kind), chunk(_chunk), priority(_priority) {}
+    // the engine's own policy at another priority, e.g. runAsyncWithDeps(r, n, deps, PRIORITY_HIGH)
+    Schedule(LaunchPriority _priority): kind(SCHEDULE_AUTO), chunk(0), priority(_priority) {}
+};
+
+/*
+  Which tasks of a dependency a task of the dependent launch waits for.
+  DEP_ALL waits for the whole launch, as runAsyncWithDeps() does.
+  DEP_IDENTITY lets task i start once task i of the dependency is done.
+  DEP_RANGE lets task i start once tasks [begin, end) of the dependency,
+  as set by `range(i, begin, end)`, are done; both bounds must be
+  non-decreasing in i.
+ */
+enum DepMapping {
+    DEP_ALL,
+    DEP_IDENTITY,
+    DEP_RANGE,
+};
+
+struct TaskDep {
+    TaskID id;
+    DepMapping mapping;
+    std::function<void(int task, int& begin, int& end)> range;  // DEP_RANGE only
+    TaskDep(TaskID _id, DepMapping _mapping = DEP_ALL): id(_id), mapping(_mapping) {}
+    TaskDep(TaskID _id, const std::function<void(int, int&, int&)>& _range)
+        : id(_id), mapping(DEP_RANGE), range(_range) {}
+};
+
+class TaskGraph;
+class IRunnable;
+
+/*
+  One launch of a submitBatch() call.  `deps` are TaskIDs of launches
+  submitted before the batch; `batch_deps` are indices of earlier
+  launches in the same batch, whose TaskIDs are not known yet.
+ */
+struct LaunchDesc {
+    IRunnable* runnable;
+    int num_total_tasks;
+    std::vector<TaskID> deps;
+    std::vector<int> batch_deps;
+    Schedule schedule;
+    LaunchDesc(IRunnable* _runnable = nullptr, int _num_total_tasks = 0,
+               const Schedule& _schedule = Schedule())
+        : runnable(_runnable), num_total_tasks(_num_total_tasks), schedule(_schedule) {}
+};
+
+/*
+  Runtime counters of one worker, see ITaskSystem::getStats().  Times
+  are in nanoseconds.  A task that waits for launches it made counts as
+  busy while it helps or sleeps, so busy, spin and parked time do not
+  overlap; lock waits are part of whichever of them took the lock.
+ */
+enum WorkerStat {
+    STAT_TASKS,             // tasks run
+    STAT_CHUNKS,            // claims of ready work, one or more tasks each
+    STAT_STEAL_ATTEMPTS,    // looks into another worker's deque
+    STAT_STEALS,            // ... that found work there
+    STAT_WAKEUPS,           // times woken from sleep for new work
+    STAT_BUSY_NS,           // running tasks
+    STAT_SPIN_NS,           // polling for work
+    STAT_PARKED_NS,         // asleep
+    STAT_LOCK_WAIT_NS,      // waiting for a contended scheduler lock
+    NUM_WORKER_STATS,
+};
+
+struct WorkerStats {
+    long long values[NUM_WORKER_STATS];
+    WorkerStats() {
+        for (int i = 0; i < NUM_WORKER_STATS; i++) {
+            values[i] = 0;
+        }
+    }
+    long long operator[](WorkerStat stat) const { return values[stat]; }
+};
+
+/*
+  Snapshot of the counters of every worker slot.  Engines whose calling
+  thread runs tasks too, inside run() or sync(), give it the last slot.
+ */
+struct TaskSystemStats {
+    bool enabled;                       // false if the task system kept no counters
+    std::vector<WorkerStats> workers;
+    TaskSystemStats(): enabled(false) {}
+    WorkerStats total() const {
+        WorkerStats sum;
+        for (const WorkerStats& w : workers) {
+            for (int i = 0; i < NUM_WORKER_STATS; i++) {
+                sum.values[i] += w.values[i];
+            }
+        }
+        return sum;
+    }
+};
+
 class IRunnable {
     public:
         virtual ~IRunnable();
@@ -18,6 +182,14 @@ class IRunnable {
              task launch.
          */
         virtual void runTask(int task_id, int num_total_tasks) = 0;
+
+        /*
+          Executes tasks begin to end-1 of the bulk task launch.  Task
+          systems hand out work in such ranges; the default calls
+          runTask() for each id, and tasks whose ids map to contiguous
+          data can override it to run the whole range in one loop.
+         */
+        virtual void runTaskRange(int begin, int end, int num_total_tasks);
 };
 
 class ITaskSystem {
@@ -26,7 +198,8 @@ class ITaskSystem {
           Instantiates a task system.
 
            - num_threads: the maximum number of threads that the task system
-             can use.
+             can use.  Thread pools given 0 size themselves from the CPU
+             topology.
          */
         ITaskSystem(int num_threads);
         virtual ~ITaskSystem();
@@ -37,8 +210,12 @@ class ITaskSystem {
           execution is synchronous with the calling thread, so run()
           will return only when the execution of all tasks is
           complete.
+
+          `schedule` selects how the tasks are divided among threads,
+          and the launch's priority class.
         */
-        virtual void run(IRunnable* runnable, int num_total_tasks) = 0;
+        virtual void run(IRunnable* runnable, int num_total_tasks,
+                         const Schedule& schedule = Schedule()) = 0;
 
         /*
           Executes an asynchronous bulk task launch of
@@ -57,14 +234,88 @@ class ITaskSystem {
           Returns an identifer that can be used in subsequent calls to
           runAsnycWithDeps() to specify a dependency of some future
           bulk task launch on this bulk task launch.
+
+          `schedule` is as for run().
          */
         virtual TaskID runAsyncWithDeps(IRunnable* runnable, int num_total_tasks,
-                                        const std::vector<TaskID>& deps) = 0;
+                                        const std::vector<TaskID>& deps,
+                                        const Schedule& schedule = Schedule()) = 0;
+
+        /*
+          Like runAsyncWithDeps(), with a mapping on each dependency so
+          that tasks can start before the whole dependency is done (see
+          TaskDep).  Task systems may treat every mapping as DEP_ALL,
+          which is what the default does.
+         */
+        virtual TaskID runAsyncWithTaskDeps(IRunnable* runnable, int num_total_tasks,
+                                            const std::vector<TaskDep>& deps,
+                                            const Schedule& schedule = Schedule());
 
         /*
           Blocks until all tasks created as a result of **any prior**
           runXXX calls are done.
          */
         virtual void sync() = 0;
+
+        /*
+          Blocks until every task of the bulk task launch `task` is
+          done.  Other launches may still be running when wait()
+          returns.
+
+          A TaskID is valid once a runXXX call has returned it; a
+          launch that finished, however long ago, stays done.  For any
+          other id there is no launch to wait for: isDone() and
+          waitFor() return false at once, and wait() reports the id on
+          stderr and returns at once.
+
+          The default implementations of wait(), waitFor() and isDone()
+          suit task systems whose launches complete before
+          runAsyncWithDeps() returns, and treat every id as done.
+         */
+        virtual void wait(TaskID task);
+
+        /*
+          Like wait(), but gives up after `timeout`.  Returns true if
+          the launch is done.
+         */
+        virtual bool waitFor(TaskID task, std::chrono::microseconds timeout);
+
+        /*
+          Returns true if every task of the bulk task launch `task` is
+          done, without blocking.
+         */
+        virtual bool isDone(TaskID task);
+
+        /*
+          Launches every node of `graph` (see taskgraph.h) like a
+          runAsyncWithDeps() call, with the graph's edges as
+          dependencies.  Nodes without dependencies inside the graph
+          also depend on every launch in `deps`.  Returns the TaskID of
+          the graph's exit node, which is done once the whole graph is.
+
+          The default submits the nodes one by one; task systems can
+          submit the whole graph at once.
+         */
+        virtual TaskID runGraph(const TaskGraph& graph,
+                                const std::vector<TaskID>& deps = std::vector<TaskID>());
+
+        /*
+          Submits every launch of `launches` like a runAsyncWithDeps()
+          call, in order, and returns their TaskIDs.  Entries of
+          batch_deps that do not name an earlier launch of the batch
+          are ignored.
+
+          The default submits the launches one by one; task systems can
+          insert the batch at once and wake their workers once for it.
+         */
+        virtual std::vector<TaskID> submitBatch(const std::vector<LaunchDesc>& launches);
+
+        /*
+          Counters the workers kept since the task system was created
+          with options.stats.  Without it, and on engines that keep no
+          counters, the snapshot is not enabled.  While launches run the
+          counts are approximate.
+         */
+        virtual TaskSystemStats getStats();
 };
 #endif
@@ -1,11 +1,77 @@
 #include "tasksys.h"
+#include <type_traits>
 
 
 IRunnable::~IRunnable() {}
 
+void IRunnable::runTaskRange(int begin, int end, int num_total_tasks) {
+    for (int i = begin; i < end; i++) {
+        runTask(i, num_total_tasks);
+    }
+}
+
 ITaskSystem::ITaskSystem(int num_threads) {}
 ITaskSystem::~ITaskSystem() {}
 
+void ITaskSystem::wait(TaskID task) {
+    sync();
+}
+
+bool ITaskSystem::waitFor(TaskID task, std::chrono::microseconds timeout) {
+    sync();
+    return true;
+}
+
+bool ITaskSystem::isDone(TaskID task) {
+    return true;
+}
+
+TaskID ITaskSystem::runAsyncWithTaskDeps(IRunnable* runnable, int num_total_tasks,
+                                         const std::vector<TaskDep>& deps, const Schedule& schedule) {
+    std::vector<TaskID> ids;
+    for (const TaskDep& dep : deps) {
+        ids.push_back(dep.id);
+    }
+    return runAsyncWithDeps(runnable, num_total_tasks, ids, schedule);
+}
+
+TaskID ITaskSystem::runGraph(const TaskGraph& graph, const std::vector<TaskID>& deps) {
+    std::vector<TaskID> ids(graph.size());
+    std::vector<TaskID> nodeDeps;
+    for (int i = 0; i < graph.size(); i++) {
+        const TaskGraphNode& node = graph.node(i);
+        nodeDeps.clear();
+        if (node.numDeps == 0) {
+            nodeDeps = deps;
+        }
+        for (int k = 0; k < node.numDeps; k++) {
+            nodeDeps.push_back(ids[graph.deps(i)[k]]);
+        }
+        ids[i] = runAsyncWithDeps(node.runner, node.numTasks, nodeDeps, node.schedule);
+    }
+    return ids.back();
+}
+
+std::vector<TaskID> ITaskSystem::submitBatch(const std::vector<LaunchDesc>& launches) {
+    std::vector<TaskID> ids(launches.size());
+    std::vector<TaskID> launchDeps;
+    for (size_t i = 0; i < launches.size(); i++) {
+        const LaunchDesc& desc = launches[i];
+        launchDeps = desc.deps;
+        for (int dep : desc.batch_deps) {
+            if (dep >= 0 && (size_t)dep < i) {
+                launchDeps.push_back(ids[dep]);
+            }
+        }
+        ids[i] = runAsyncWithDeps(desc.runnable, desc.num_total_tasks, launchDeps, desc.schedule);
+    }
+    return ids;
+}
+
+TaskSystemStats ITaskSystem::getStats() {
+    return TaskSystemStats();
+}
+
 /*
  * ================================================================
  * Serial task system implementation
@@ -21,14 +87,13 @@ TaskSystemSerial::TaskSystemSerial(int num_threads): ITaskSystem(num_threads) {
 
 TaskSystemSerial::~TaskSystemSerial() {}
 
-void TaskSystemSerial::run(IRunnable* runnable, int num_total_tasks) {
-    for (int i = 0; i < num_total_tasks; i++) {
-        runnable->runTask(i, num_total_tasks);
-    }
+void TaskSystemSerial::run(IRunnable* runnable, int num_total_tasks, const Schedule& schedule) {
+    runnable->runTaskRange(0, num_total_tasks, num_total_tasks);
 }
 
 TaskID TaskSystemSerial::runAsyncWithDeps(IRunnable* runnable, int num_total_tasks,
-                                          const std::vector<TaskID>& deps) {
+                                          const std::vector<TaskID>& deps,
+                                          const Schedule& schedule) {
     // You do not need to implement this method.
     return 0;
 }
@@ -44,34 +109,69 @@ void TaskSystemSerial::sync() {
  * ================================================================
  */
 
+// runs one claimed chunk of tasks, counting it if `counters` is set
+static inline void runCountedChunk(IRunnable* runnable, int begin, int end, int num_total_tasks,
+                                   WorkerCounters* counters) {
+    if (counters == nullptr) {
+        runnable->runTaskRange(begin, end, num_total_tasks);
+        return;
+    }
+    StatTimer busy(counters, STAT_BUSY_NS);
+    runnable->runTaskRange(begin, end, num_total_tasks);
+    counters->add(STAT_TASKS, end - begin);
+    counters->add(STAT_CHUNKS);
+}
+
+// snapshot of `count` slots of counters; not enabled when there are none
+static TaskSystemStats snapshotCounters(const WorkerCounters* counters, int count) {
+    TaskSystemStats snapshot;
+    if (counters == nullptr) {
+        return snapshot;
+    }
+    snapshot.enabled = true;
+    for (int i = 0; i < count; i++) {
+        snapshot.workers.push_back(counters[i].snapshot());
+    }
+    return snapshot;
+}
+
 const char* TaskSystemParallelSpawn::name() {
     return "Parallel + Always Spawn";
 }
 
-TaskSystemParallelSpawn::TaskSystemParallelSpawn(int num_threads): ITaskSystem(num_threads) {
+TaskSystemParallelSpawn::TaskSystemParallelSpawn(int num_threads, const TaskSystemOptions& options): ITaskSystem(num_threads) {
     //
     // TODO: CS149 student implementations may decide to perform setup
     // operations (such as thread pool construction) here.
     // Implementations are free to add new class member variables
     // (requiring changes to tasksys.h).
     //
-    maxThread = num_threads;
+    maxThread = resolveThreadCount(num_threads);
+    placement = CpuTopology::get().placement(options.pin_policy, maxThread, options.pin_cpus);
+    if (options.stats) {
+        workerCounters.reset(new WorkerCounters[maxThread]);
+    }
 }
 
 TaskSystemParallelSpawn::~TaskSystemParallelSpawn() {}
 
-void TaskSystemParallelSpawn::spawnThreadRunFunc(IRunnable* runnable, int num_total_tasks, std::atomic<int>& taskIndex) {
-    while (true) {
-        int curIndex = taskIndex.fetch_add(1);
-        if (curIndex > num_total_tasks) {
-            break;
-        }
-        runnable->runTask(curIndex, num_total_tasks);
+void TaskSystemParallelSpawn::spawnThreadRunFunc(IRunnable* runnable, int num_total_tasks, const Schedule& schedule,
+                                                 int threadId, std::atomic<int>& taskIndex) {
+    WorkerCounters* counters = workerCounters ? &workerCounters[threadId] : nullptr;
+    auto runChunk = [runnable, num_total_tasks, counters](int begin, int end) {
+        runCountedChunk(runnable, begin, end, num_total_tasks, counters);
+    };
+    if (schedule.kind == SCHEDULE_STATIC) {
+        forEachStaticChunk(schedule, num_total_tasks, maxThread, threadId, runChunk);
+        return;
+    }
+    int begin, end;
+    while (claimChunk(taskIndex, schedule, num_total_tasks, maxThread, begin, end)) {
+        runChunk(begin, end);
     }
-    runnable->runTask(taskIndex, num_total_tasks);
 }
 
-void TaskSystemParallelSpawn::run(IRunnable* runnable, int num_total_tasks) {
+void TaskSystemParallelSpawn::run(IRunnable* runnable, int num_total_tasks, const Schedule& schedule) {
     //
     // TODO: CS149 students will modify the implementation of this
     // method in Part A.  The implementation provided below runs all
@@ -80,15 +180,18 @@ void TaskSystemParallelSpawn::run(IRunnable* runnable, int num_total_tasks) {
     std::atomic<int> taskIndex(0);
     std::vector<std::thread> allThread;
     for (int i = 0; i < maxThread; i++) {
-        allThread.emplace_back(std::thread(&TaskSystemParallelSpawn::spawnThreadRunFunc, this, runnable, num_total_tasks, std::ref(taskIndex)));
+        allThread.emplace_back(std::thread(&TaskSystemParallelSpawn::spawnThreadRunFunc, this, runnable, num_total_tasks,
+                                           std::cref(schedule), i, std::ref(taskIndex)));
     }
+    pinWorkers(allThread, placement);
     for (auto& t : allThread) {
         t.join();
     }
 }
 
 TaskID TaskSystemParallelSpawn::runAsyncWithDeps(IRunnable* runnable, int num_total_tasks,
-                                                 const std::vector<TaskID>& deps) {
+                                                 const std::vector<TaskID>& deps,
+                                                 const Schedule& schedule) {
     // You do not need to implement this method.
     return 0;
 }
@@ -98,58 +201,119 @@ void TaskSystemParallelSpawn::sync() {
     return;
 }
 
+TaskSystemStats TaskSystemParallelSpawn::getStats() {
+    return snapshotCounters(workerCounters.get(), maxThread);
+}
+
 /*
  * ================================================================
  * Parallel Thread Pool Spinning Task System Implementation
  * ================================================================
  */
 
+// pool whose task the current thread is running, if any
+static thread_local ITaskSystem* tlsPool = nullptr;
+
 const char* TaskSystemParallelThreadPoolSpinning::name() {
     return "Parallel + Thread Pool + Spin";
 }
 
-TaskSystemParallelThreadPoolSpinning::TaskSystemParallelThreadPoolSpinning(int num_threads): ITaskSystem(num_threads) {
-    //
-    // TODO: CS149 student implementations may decide to perform setup
-    // operations (such as thread pool construction) here.
-    // Implementations are free to add new class member variables
-    // (requiring changes to tasksys.h).
-    //
-    maxThread = num_threads;
+/*
+ * Workers live as long as the task system and spin on `generation`
+ * between launches.  run() publishes a launch by bumping the generation,
+ * claims chunks alongside the workers from `nextTask`, and returns once
+ * every participant has reached the `done` barrier, which also leaves
+ * the workers ready for the next launch.
+ */
+TaskSystemParallelThreadPoolSpinning::TaskSystemParallelThreadPoolSpinning(int num_threads, const TaskSystemOptions& options)
+    : ITaskSystem(num_threads), maxThread(resolveThreadCount(num_threads)), numParticipants(maxThread + 1),
+      runner(nullptr), totalTask(0), stop(false), callerSense(false), generation(0), nextTask(0),
+      done(maxThread + 1) {
+    if (options.stats) {
+        workerCounters.reset(new WorkerCounters[numParticipants]);
+    }
+    for (int i = 0; i < maxThread; i++) {
+        workers.emplace_back(std::thread(&TaskSystemParallelThreadPoolSpinning::spinThreadRunFunc, this, i));
+    }
+    pinWorkers(workers, CpuTopology::get().placement(options.pin_policy, maxThread, options.pin_cpus));
 }
 
-TaskSystemParallelThreadPoolSpinning::~TaskSystemParallelThreadPoolSpinning() {}
+TaskSystemParallelThreadPoolSpinning::~TaskSystemParallelThreadPoolSpinning() {
+    stop.store(true, std::memory_order_release);
+    for (auto& t : workers) {
+        t.join();
+    }
+}
 
-void TaskSystemParallelThreadPoolSpinning::spinThreadRunFunc(IRunnable* runnable, int num_total_tasks, TasLock& lock, int& nextTask) {
-    int curTask = -1;
-    while (curTask < num_total_tasks) {
-        lock.lock();
-        curTask = nextTask;
-        nextTask++;
-        lock.unlock();
-        runnable->runTask(curTask, num_total_tasks);
+// runs chunks of the current launch until none are left to claim
+void TaskSystemParallelThreadPoolSpinning::runChunks(int threadId) {
+    IRunnable* runnable = runner;
+    int total = totalTask;
+    WorkerCounters* counters = workerCounters ? &workerCounters[threadId] : nullptr;
+    auto runChunk = [runnable, total, counters](int begin, int end) {
+        runCountedChunk(runnable, begin, end, total, counters);
+    };
+    if (schedule.kind == SCHEDULE_STATIC) {
+        forEachStaticChunk(schedule, total, numParticipants, threadId, runChunk);
+        return;
+    }
+    int begin, end;
+    while (claimChunk(nextTask, schedule, total, numParticipants, begin, end)) {
+        runChunk(begin, end);
     }
-    
 }
 
-void TaskSystemParallelThreadPoolSpinning::run(IRunnable* runnable, int num_total_tasks) {
-    //
-    // TODO: CS149 students will modify the implementation of this
-    // method in Part A.  The implementation provided below runs all
-    // tasks sequentially on the calling thread.
-    //
-    TasLock spinlock;
-    int nextTask = 0;
-    for (int i = 0; i < maxThread; i++) {
-        threadPool.emplace_back(std::thread(&TaskSystemParallelThreadPoolSpinning::spinThreadRunFunc, this, runnable, num_total_tasks, std::ref(spinlock), std::ref(nextTask)));
+// waiting for a launch and at the barrier both count as spinning
+void TaskSystemParallelThreadPoolSpinning::spinThreadRunFunc(int threadId) {
+    tlsPool = this;
+    WorkerCounters* counters = workerCounters ? &workerCounters[threadId] : nullptr;
+    unsigned seen = 0;
+    bool sense = false;
+    while (true) {
+        {
+            StatTimer spin(counters, STAT_SPIN_NS);
+            spinUntil([this, seen]() {
+                return generation.load(std::memory_order_acquire) != seen || stop.load(std::memory_order_acquire);
+            });
+        }
+        if (stop.load(std::memory_order_acquire)) {
+            break;
+        }
+        seen = generation.load(std::memory_order_acquire);
+        runChunks(threadId);
+        StatTimer spin(counters, STAT_SPIN_NS);
+        done.wait(sense);
     }
-    for (auto& t : threadPool) {
-        t.join();
+}
+
+/*
+ * A run() made from inside one of the pool's own tasks executes inline,
+ * since the workers are all busy with the outer launch.
+ */
+void TaskSystemParallelThreadPoolSpinning::run(IRunnable* runnable, int num_total_tasks, const Schedule& schedule) {
+    if (num_total_tasks <= 0) {
+        return;
     }
+    if (tlsPool == this) {
+        runnable->runTaskRange(0, num_total_tasks, num_total_tasks);
+        return;
+    }
+    runner = runnable;
+    totalTask = num_total_tasks;
+    this->schedule = schedule;
+    nextTask.store(0, std::memory_order_relaxed);
+    generation.fetch_add(1, std::memory_order_release);
+
+    tlsPool = this;
+    runChunks(maxThread);
+    tlsPool = nullptr;
+    StatTimer spin(workerCounters ? &workerCounters[maxThread] : nullptr, STAT_SPIN_NS);
+    done.wait(callerSense);
 }
 
 TaskID TaskSystemParallelThreadPoolSpinning::runAsyncWithDeps(IRunnable* runnable, int num_total_tasks,
-                                                              const std::vector<TaskID>& deps) {
+                                                              const std::vector<TaskID>& deps,
+                                                              const Schedule& schedule) {
     // You do not need to implement this method.
     return 0;
 }
@@ -159,79 +323,257 @@ void TaskSystemParallelThreadPoolSpinning::sync() {
     return;
 }
 
+TaskSystemStats TaskSystemParallelThreadPoolSpinning::getStats() {
+    return snapshotCounters(workerCounters.get(), numParticipants);
+}
+
 /*
  * ================================================================
  * Parallel Thread Pool Sleeping Task System Implementation
  * ================================================================
  */
 
-const char* TaskSystemParallelThreadPoolSleeping::name() {
-    return "Parallel + Thread Pool + Sleep";
+template <typename Lock>
+const char* BasicTaskSystemParallelThreadPoolSleeping<Lock>::name() {
+    return displayName.c_str();
 }
 
-TaskSystemParallelThreadPoolSleeping::TaskSystemParallelThreadPoolSleeping(int num_threads): ITaskSystem(num_threads) {
-    maxThread = num_threads;
+template <typename Lock>
+BasicTaskSystemParallelThreadPoolSleeping<Lock>::BasicTaskSystemParallelThreadPoolSleeping(int num_threads, const TaskSystemOptions& options): ITaskSystem(num_threads) {
+    maxThread = resolveThreadCount(num_threads);
     stop = false;
-    totalTask = finishedTask = 0;
-    
-    for (int i = 0; i < maxThread; i++) {
-        workers.emplace_back(std::thread([this]() {sleepThreadRunFunc();}));
+    runner = nullptr;
+    displayName = "Parallel + Thread Pool + Sleep";
+    if (!std::is_same<Lock, std::mutex>::value) {
+        displayName += std::string(" + ") + lockName<Lock>() + " lock";
+    }
+    numParticipants = 1;
+    totalTask = nextTask = finishedTask = 0;
+    elastic = options.elastic;
+    verbose = options.verbose;
+    minThread = elastic ? std::min(maxThread, std::max(1, options.min_threads)) : maxThread;
+    growDelay = std::chrono::microseconds(std::max(0, options.grow_delay_us));
+    idleTimeout = std::chrono::microseconds(std::max(0, options.idle_timeout_us));
+    numWorkers = 0;
+    spawns = retires = 0;
+    placement = CpuTopology::get().placement(options.pin_policy, maxThread, options.pin_cpus);
+    if (options.stats) {
+        workerCounters.reset(new WorkerCounters[maxThread + 1]);
+    }
+
+    workers.resize(maxThread);
+    attached.assign(maxThread, false);
+    for (int i = 0; i < minThread; i++) {
+        startWorker(i);
     }
 }
 
-TaskSystemParallelThreadPoolSleeping::~TaskSystemParallelThreadPoolSleeping() {
-    stop = true;
+template <typename Lock>
+BasicTaskSystemParallelThreadPoolSleeping<Lock>::~BasicTaskSystemParallelThreadPoolSleeping() {
+    {
+        std::lock_guard<Lock> lockConsumer(mutexConsumer);
+        stop = true;
+    }
     cvConsumer.notify_all();
     for (auto& w : workers) {
-        w.join();
+        if (w.joinable()) {
+            w.join();
+        }
+    }
+    if (verbose && elastic) {
+        printf("  elastic: %d to %d workers, %ld spawned, %ld retired\n", minThread, maxThread, spawns, retires);
     }
 }
 
-void TaskSystemParallelThreadPoolSleeping::sleepThreadRunFunc() {
-    while (true) {
-        std::unique_lock<std::mutex> lockConsumer(mutexConsumer);
-        auto func = [this]() { return stop || (nextTask < totalTask); };
-        cvConsumer.wait(lockConsumer, func);
+// starts a thread in the free slot `workerId`; mutexConsumer is held
+// except during construction
+template <typename Lock>
+void BasicTaskSystemParallelThreadPoolSleeping<Lock>::startWorker(int workerId) {
+    if (workers[workerId].joinable()) {
+        // the slot's previous thread retired and is on its way out
+        workers[workerId].join();
+    }
+    attached[workerId] = true;
+    numWorkers++;
+    workers[workerId] = std::thread([this, workerId]() {sleepThreadRunFunc(workerId);});
+    if (!placement.empty()) {
+        pinThread(workers[workerId], placement[workerId]);
+    }
+}
 
-        if (stop && nextTask == totalTask) {
-            // std::cerr << "worker quit" << std::endl;
+/*
+ * Elastic pool growth, checked on every claim with mutexConsumer held:
+ * a launch that still has unclaimed tasks growDelay after it started,
+ * or after the last worker was added, gets one more worker.
+ */
+template <typename Lock>
+void BasicTaskSystemParallelThreadPoolSleeping<Lock>::maybeGrow() {
+    if (numWorkers >= maxThread || nextTask >= totalTask || stop) {
+        return;
+    }
+    std::chrono::steady_clock::time_point now = std::chrono::steady_clock::now();
+    if (now - backlogSince < growDelay) {
+        return;
+    }
+    for (int i = 0; i < maxThread; i++) {
+        if (!attached[i]) {
+            startWorker(i);
+            spawns++;
             break;
         }
+    }
+    backlogSince = now;
+}
 
-        int taskIndex = nextTask++;
-        lockConsumer.unlock();
-        // std::cerr << "worker run: " << taskIndex << std::endl;
-        runner->runTask(taskIndex, totalTask);
+// mutexConsumer must be held
+template <typename Lock>
+bool BasicTaskSystemParallelThreadPoolSleeping<Lock>::claimTasks(int& begin, int& end) {
+    if (nextTask >= totalTask) {
+        return false;
+    }
+    begin = nextTask;
+    nextTask += scheduleChunk(schedule, totalTask - nextTask, totalTask, numParticipants);
+    end = nextTask;
+    if (elastic) {
+        maybeGrow();
+    }
+    return true;
+}
 
+template <typename Lock>
+void BasicTaskSystemParallelThreadPoolSleeping<Lock>::finishTasks(int count, WorkerCounters* counters) {
+    CountedLockGuard<Lock> lockFinish(mutexFinish, counters);
+    finishedTask += count;
+    if (finishedTask == totalTask) {
+        cvProducer.notify_all();
+    }
+}
+
+/*
+ * A worker of the elastic pool that waits idleTimeout without work
+ * retires, unless the pool is down to minThread workers.
+ *
+ * With stats, a wait that found no work at first counts as parked, and
+ * as a wakeup if it ends with tasks to claim.
+ */
+template <typename Lock>
+void BasicTaskSystemParallelThreadPoolSleeping<Lock>::sleepThreadRunFunc(int workerId) {
+    tlsPool = this;
+    WorkerCounters* counters = workerCounters ? &workerCounters[workerId] : nullptr;
+    while (true) {
+        std::unique_lock<Lock> lockConsumer(mutexConsumer, std::defer_lock);
+        lockCounted(lockConsumer, counters);
+        auto func = [this]() { return stop || (nextTask < totalTask); };
+        bool sleeping = counters != nullptr && !func();
         {
-            std::lock_guard<std::mutex> lockFinish(mutexFinish);
-            finishedTask++;
-            // std::cerr << "finished task: " << finishedTask << std::endl;
-            if (finishedTask == totalTask) {
-                cvProducer.notify_all();
+            StatTimer parked(sleeping ? counters : nullptr, STAT_PARKED_NS);
+            if (!elastic) {
+                cvConsumer.wait(lockConsumer, func);
+            } else if (!cvConsumer.wait_for(lockConsumer, idleTimeout, func)) {
+                if (numWorkers > minThread) {
+                    numWorkers--;
+                    retires++;
+                    attached[workerId] = false;
+                    break;
+                }
+                continue;
             }
         }
+        if (sleeping && nextTask < totalTask) {
+            counters->add(STAT_WAKEUPS);
+        }
+
+        // woken with nothing to claim only when stopping
+        int begin, end;
+        if (!claimTasks(begin, end)) {
+            break;
+        }
+        IRunnable* runnable = runner;
+        int total = totalTask;
+        lockConsumer.unlock();
+        runCountedChunk(runnable, begin, end, total, counters);
+        finishTasks(end - begin, counters);
     }
 }
 
-void TaskSystemParallelThreadPoolSleeping::run(IRunnable* runnable, int num_total_tasks) {
-    runner = runnable;
-    totalTask = num_total_tasks;
-    finishedTask = 0;
+/*
+ * The calling thread takes tasks from the same counter as the workers
+ * until none are left, then waits for the ones still running.  Only as
+ * many workers are woken as there are tasks beyond the caller's first,
+ * and a single-task launch runs inline without waking anyone.
+ *
+ * The pool holds one launch at a time, so a run() made from inside one
+ * of its own tasks executes inline on the calling thread.
+ *
+ * Workers are not bound to ids here, so SCHEDULE_STATIC hands out its
+ * fixed blocks in order to whichever thread asks next.
+ */
+template <typename Lock>
+void BasicTaskSystemParallelThreadPoolSleeping<Lock>::run(IRunnable* runnable, int num_total_tasks, const Schedule& schedule) {
+    if (num_total_tasks <= 0) {
+        return;
+    }
+    if (tlsPool == this) {
+        runnable->runTaskRange(0, num_total_tasks, num_total_tasks);
+        return;
+    }
+    WorkerCounters* counters = workerCounters ? &workerCounters[maxThread] : nullptr;
+    if (num_total_tasks == 1 || maxThread == 0) {
+        runCountedChunk(runnable, 0, num_total_tasks, num_total_tasks, counters);
+        return;
+    }
+
+    {
+        CountedLockGuard<Lock> lockFinish(mutexFinish, counters);
+        finishedTask = 0;
+    }
     {
-        std::lock_guard<std::mutex> lockConsumer(mutexConsumer);
+        CountedLockGuard<Lock> lockConsumer(mutexConsumer, counters);
+        runner = runnable;
+        this->schedule = schedule;
+        numParticipants = std::min(num_total_tasks, maxThread + 1);
+        totalTask = num_total_tasks;
         nextTask = 0;
+        if (elastic) {
+            backlogSince = std::chrono::steady_clock::now();
+        }
     }
-    // std::cerr << "producer notify all consumer" << std::endl;
-    cvConsumer.notify_all();
+    // one worker per chunk beyond the caller's first
+    int firstChunk = scheduleChunk(schedule, num_total_tasks, num_total_tasks, numParticipants);
+    int helpers = (num_total_tasks + firstChunk - 1) / firstChunk - 1;
+    if (helpers >= maxThread) {
+        cvConsumer.notify_all();
+    } else {
+        for (int i = 0; i < helpers; i++) {
+            cvConsumer.notify_one();
+        }
+    }
+
+    tlsPool = this;
+    while (true) {
+        int begin, end;
+        {
+            CountedLockGuard<Lock> lockConsumer(mutexConsumer, counters);
+            if (!claimTasks(begin, end)) {
+                break;
+            }
+        }
+        runCountedChunk(runnable, begin, end, num_total_tasks, counters);
+        finishTasks(end - begin, counters);
+    }
+    tlsPool = nullptr;
 
-    std::unique_lock<std::mutex> lockFinish(mutexFinish);
+    std::unique_lock<Lock> lockFinish(mutexFinish, std::defer_lock);
+    lockCounted(lockFinish, counters);
     auto func = [this]() { return finishedTask == totalTask; };
+    StatTimer parked(func() ? nullptr : counters, STAT_PARKED_NS);
     cvProducer.wait(lockFinish, func);
 }
 
-TaskID TaskSystemParallelThreadPoolSleeping::runAsyncWithDeps(IRunnable* runnable, int num_total_tasks,
-                                                    const std::vector<TaskID>& deps) {
+template <typename Lock>
+TaskID BasicTaskSystemParallelThreadPoolSleeping<Lock>::runAsyncWithDeps(IRunnable* runnable, int num_total_tasks,
+                                                    const std::vector<TaskID>& deps,
+                                                    const Schedule& schedule) {
 
 
     //
@@ -241,7 +583,8 @@ TaskID TaskSystemParallelThreadPoolSleeping::runAsyncWithDeps(IRunnable* runnabl
     return 0;
 }
 
-void TaskSystemParallelThreadPoolSleeping::sync() {
+template <typename Lock>
+void BasicTaskSystemParallelThreadPoolSleeping<Lock>::sync() {
 
     //
     // TODO: CS149 students will modify the implementation of this method in Part B.
@@ -249,3 +592,14 @@ void TaskSystemParallelThreadPoolSleeping::sync() {
 
     return;
 }
+
+template <typename Lock>
+TaskSystemStats BasicTaskSystemParallelThreadPoolSleeping<Lock>::getStats() {
+    return snapshotCounters(workerCounters.get(), maxThread + 1);
+}
+
+template class BasicTaskSystemParallelThreadPoolSleeping<std::mutex>;
+template class BasicTaskSystemParallelThreadPoolSleeping<TtasLock>;
+template class BasicTaskSystemParallelThreadPoolSleeping<TicketLock>;
+template class BasicTaskSystemParallelThreadPoolSleeping<McsLock>;
+template class BasicTaskSystemParallelThreadPoolSleeping<FutexLock>;
@@ -2,12 +2,21 @@
 #define _TASKSYS_H
 
 #include <atomic>
+#include <chrono>
 #include <condition_variable>
 #include <mutex>
 #include <iostream>
+#include <memory>
 #include <queue>
+#include <string>
 #include <thread>
 #include "itasksys.h"
+#include "locks.h"
+#include "schedule.h"
+#include "spinlock.h"
+#include "taskgraph.h"
+#include "topology.h"
+#include "workerstats.h"
 
 /*
  * TaskSystemSerial: This class is the student's implementation of a
@@ -19,9 +28,10 @@ class TaskSystemSerial: public ITaskSystem {
         TaskSystemSerial(int num_threads);
         ~TaskSystemSerial();
         const char* name();
-        void run(IRunnable* runnable, int num_total_tasks);
+        void run(IRunnable* runnable, int num_total_tasks, const Schedule& schedule = Schedule());
         TaskID runAsyncWithDeps(IRunnable* runnable, int num_total_tasks,
-                                const std::vector<TaskID>& deps);
+                                const std::vector<TaskID>& deps,
+                                const Schedule& schedule = Schedule());
         void sync();
 };
 
@@ -33,26 +43,55 @@ class TaskSystemSerial: public ITaskSystem {
  */
 class TaskSystemParallelSpawn: public ITaskSystem {
     public:
-        TaskSystemParallelSpawn(int num_threads);
+        TaskSystemParallelSpawn(int num_threads, const TaskSystemOptions& options = TaskSystemOptions());
         ~TaskSystemParallelSpawn();
         const char* name();
-        void run(IRunnable* runnable, int num_total_tasks);
-        void spawnThreadRunFunc(IRunnable* runnable, int num_total_tasks, std::atomic<int>& taskIndex);
+        void run(IRunnable* runnable, int num_total_tasks, const Schedule& schedule = Schedule());
+        void spawnThreadRunFunc(IRunnable* runnable, int num_total_tasks, const Schedule& schedule, int threadId,
+                                std::atomic<int>& taskIndex);
         TaskID runAsyncWithDeps(IRunnable* runnable, int num_total_tasks,
-                                const std::vector<TaskID>& deps);
+                                const std::vector<TaskID>& deps,
+                                const Schedule& schedule = Schedule());
         void sync();
+        TaskSystemStats getStats();
     private:
         int maxThread;
+        std::vector<int> placement;     // cpu of each spawned thread, empty if unpinned
+        std::unique_ptr<WorkerCounters[]> workerCounters;  // of spawned thread i, null without options.stats
 };
 
-struct TasLock {
-    std::atomic<bool> lock_ = {false};
-    void lock() {
-        while (lock_.exchange(true)) ;
-    }
-    void unlock() {
-        lock_.store(false);
-    }
+static const int kCacheLine = 64;
+
+/*
+ * SenseBarrier: centralized sense-reversing barrier for a fixed set of
+ * `count` threads.  Each thread passes its own sense flag, false before
+ * its first wait(); the last thread to arrive resets the count and flips
+ * the shared sense, which releases the others, so the barrier can be
+ * reused at once.  The count and the sense sit on cache lines of their
+ * own, padded by hand because C++11 operator new ignores alignas.
+ */
+class SenseBarrier {
+    public:
+        explicit SenseBarrier(int count): count_(count), remaining_(count), sense_(false) {}
+
+        void wait(bool& local_sense) {
+            local_sense = !local_sense;
+            if (remaining_.fetch_sub(1, std::memory_order_acq_rel) == 1) {
+                remaining_.store(count_, std::memory_order_relaxed);
+                sense_.store(local_sense, std::memory_order_release);
+                return;
+            }
+            bool target = local_sense;
+            spinUntil([this, target]() { return sense_.load(std::memory_order_acquire) == target; });
+        }
+
+    private:
+        int count_;
+        char pad0_[kCacheLine];
+        std::atomic<int> remaining_;
+        char pad1_[kCacheLine];
+        std::atomic<bool> sense_;
+        char pad2_[kCacheLine];
 };
 
 /*
@@ -63,17 +102,39 @@ struct TasLock {
  */
 class TaskSystemParallelThreadPoolSpinning: public ITaskSystem {
     public:
-        TaskSystemParallelThreadPoolSpinning(int num_threads);
+        TaskSystemParallelThreadPoolSpinning(int num_threads,
+                                             const TaskSystemOptions& options = TaskSystemOptions());
         ~TaskSystemParallelThreadPoolSpinning();
         const char* name();
-        void run(IRunnable* runnable, int num_total_tasks);
-        void spinThreadRunFunc(IRunnable* runnable, int num_total_tasks, TasLock& lock, int& nextTask);
+        void run(IRunnable* runnable, int num_total_tasks, const Schedule& schedule = Schedule());
+        void spinThreadRunFunc(int threadId);
         TaskID runAsyncWithDeps(IRunnable* runnable, int num_total_tasks,
-                                const std::vector<TaskID>& deps);
+                                const std::vector<TaskID>& deps,
+                                const Schedule& schedule = Schedule());
         void sync();
+        TaskSystemStats getStats();
     private:
+        void runChunks(int threadId);
+
         int maxThread;
-        std::vector<std::thread> threadPool;
+        int numParticipants;            // workers plus the thread inside run()
+        std::vector<std::thread> workers;
+        std::unique_ptr<WorkerCounters[]> workerCounters;  // one per participant, null without options.stats
+
+        // the current launch, written by run() before it bumps generation
+        IRunnable* runner;
+        int totalTask;
+        Schedule schedule;
+        std::atomic<bool> stop;
+        bool callerSense;               // sense flag of the thread inside run(), one at a time
+
+        // hot shared state, each on its own cache line
+        char pad0_[kCacheLine];
+        std::atomic<unsigned> generation;   // one more per launch, workers spin on it between launches
+        char pad1_[kCacheLine];
+        std::atomic<int> nextTask;          // claim counter of the current launch
+        char pad2_[kCacheLine];
+        SenseBarrier done;                  // every participant arrives once per launch
 };
 
 /*
@@ -81,25 +142,56 @@ class TaskSystemParallelThreadPoolSpinning: public ITaskSystem {
  * optimized implementation of a parallel task execution engine that uses
  * a thread pool. See definition of ITaskSystem in
  * itasksys.h for documentation of the ITaskSystem interface.
+ *
+ * Both of its locks are of type Lock, see common/locks.h; tasksys.cpp
+ * instantiates it for every lock there.
  */
-class TaskSystemParallelThreadPoolSleeping: public ITaskSystem {
+template <typename Lock>
+class BasicTaskSystemParallelThreadPoolSleeping: public ITaskSystem {
     public:
-        TaskSystemParallelThreadPoolSleeping(int num_threads);
-        ~TaskSystemParallelThreadPoolSleeping();
+        BasicTaskSystemParallelThreadPoolSleeping(int num_threads,
+                                                  const TaskSystemOptions& options = TaskSystemOptions());
+        ~BasicTaskSystemParallelThreadPoolSleeping();
         const char* name();
-        void run(IRunnable* runnable, int num_total_tasks);
-        void sleepThreadRunFunc();
+        void run(IRunnable* runnable, int num_total_tasks, const Schedule& schedule = Schedule());
+        void sleepThreadRunFunc(int workerId);
         TaskID runAsyncWithDeps(IRunnable* runnable, int num_total_tasks,
-                                const std::vector<TaskID>& deps);
+                                const std::vector<TaskID>& deps,
+                                const Schedule& schedule = Schedule());
         void sync();
+        TaskSystemStats getStats();
     private:
+        bool claimTasks(int& begin, int& end);
+        void finishTasks(int count, WorkerCounters* counters);
+        void startWorker(int workerId);
+        void maybeGrow();
+
         int maxThread;
         IRunnable* runner;
+        Schedule schedule;      // of the current launch
+        int numParticipants;    // threads sharing the current launch, the caller included
         std::vector<std::thread> workers;
-        std::condition_variable cvProducer, cvConsumer;
-        std::mutex mutexConsumer, mutexFinish;
+        typename ConditionFor<Lock>::type cvProducer, cvConsumer;
+        Lock mutexConsumer, mutexFinish;
         int totalTask, nextTask, finishedTask;
         bool stop;
+
+        // elastic pool, guarded by mutexConsumer: workers run in slots
+        // 0 .. maxThread-1 and are added while a launch has tasks left
+        // after growDelay, and retire after idleTimeout without work
+        bool elastic;
+        bool verbose;
+        int minThread;
+        std::chrono::microseconds growDelay, idleTimeout;
+        std::vector<int> placement;     // cpu of each worker slot, empty if unpinned
+        std::vector<bool> attached;     // a worker thread runs in the slot
+        int numWorkers;                 // workers not retiring
+        std::chrono::steady_clock::time_point backlogSince;    // start of the launch or last spawn
+        long spawns, retires;
+        std::unique_ptr<WorkerCounters[]> workerCounters;  // workers, then the thread inside run(); null without options.stats
+        std::string displayName;
 };
 
+typedef BasicTaskSystemParallelThreadPoolSleeping<std::mutex> TaskSystemParallelThreadPoolSleeping;
+
 #endif
@@ -0,0 +1,248 @@
+#ifndef _LAUNCHTABLE_H
+#define _LAUNCHTABLE_H
+
+#include <atomic>
+#include <memory>
+#include <mutex>
+#include <vector>
+#include "itasksys.h"
+#include "spinlock.h"
+
+struct LaunchRecord;
+struct TaskScope;
+
+/*
+ * EdgeNode: one dependency edge, linked into the successor list of the
+ * predecessor or the predecessor list of the dependent launch.  `id`
+ * is the TaskID of `launch` when the edge was added, so a reader can
+ * tell whether the slot has since been recycled.  Edges of per-task
+ * successor lists carry the index of their mapping in the dependent
+ * launch's taskDeps.
+ */
+struct EdgeNode {
+    LaunchRecord* launch;
+    TaskID id;
+    int depIndex;
+    EdgeNode* next;
+};
+
+struct EdgeList {
+    EdgeNode* first;
+    EdgeNode* last;
+    EdgeList(): first(nullptr), last(nullptr) {}
+    bool empty() const { return first == nullptr; }
+    void push(EdgeNode* node) {
+        node->next = first;
+        if (first == nullptr) {
+            last = node;
+        }
+        first = node;
+    }
+    void clear() { first = last = nullptr; }
+};
+
+/*
+ * EdgePool: free list of EdgeNodes shared by all launches.  Nodes are
+ * carved out of slabs that are only freed with the pool, and a retiring
+ * launch hands a whole list back in one splice, so once the pool holds
+ * as many nodes as the graph has live edges no more memory is
+ * allocated.
+ */
+class EdgePool {
+    public:
+        EdgePool(): freeList(nullptr), numSlabs(0) {
+            addSlab();
+        }
+        ~EdgePool() {
+            for (EdgeNode* slab : slabs) {
+                delete[] slab;
+            }
+        }
+
+        EdgeNode* alloc(LaunchRecord* launch, TaskID id, int depIndex = -1) {
+            lock.lock();
+            if (freeList == nullptr) {
+                addSlab();
+            }
+            EdgeNode* node = freeList;
+            freeList = node->next;
+            lock.unlock();
+            node->launch = launch;
+            node->id = id;
+            node->depIndex = depIndex;
+            node->next = nullptr;
+            return node;
+        }
+
+        void release(const EdgeList& list) {
+            lock.lock();
+            list.last->next = freeList;
+            freeList = list.first;
+            lock.unlock();
+        }
+
+        // slabs allocated after the initial one
+        long growCount() {
+            return numSlabs.load() - 1;
+        }
+
+    private:
+        static const int kSlabSize = 256;
+
+        void addSlab() {
+            EdgeNode* slab = new EdgeNode[kSlabSize];
+            for (int i = 0; i < kSlabSize; i++) {
+                slab[i].next = i + 1 < kSlabSize ? &slab[i + 1] : freeList;
+            }
+            freeList = slab;
+            slabs.push_back(slab);
+            numSlabs.fetch_add(1, std::memory_order_relaxed);
+        }
+
+        SpinLock lock;
+        EdgeNode* freeList;
+        std::vector<EdgeNode*> slabs;
+        std::atomic<long> numSlabs;
+};
+
+/*
+ * LaunchRecord: scheduler state of one bulk task launch.  Records live
+ * in the slots of a LaunchTable and are recycled, never freed, while the
+ * task system is alive.
+ *
+ * `tag` is the generation tag of the slot: 2 * id while launch `id` is
+ * live and 2 * id + 1 once it is retired.  It only grows, so a launch is
+ * done iff the tag of its slot is at least 2 * id + 1.
+ */
+struct alignas(64) LaunchRecord {
+    std::atomic<long long> tag;
+    IRunnable* runner;
+    TaskID id;
+    int totalTask;
+    Schedule schedule;                  // how the tasks are handed out
+    std::atomic<int> remainingTasks;    // tasks of this launch not yet finished
+    std::atomic<int> pendingDeps;       // unfinished dependencies, +1 while being submitted
+    SpinLock lock;                      // guards successors, waiters and helpers
+    int waiters;                        // threads blocked in wait()/waitFor()
+    int helpers;                        // workers running other tasks until this launch is done
+    TaskScope* scope;                   // task that submitted this launch, if it came from inside one
+    EdgeList successors;                // launches waiting on this one
+    EdgeList predecessors;              // dependencies, critical-path scheduling only; guarded by the pool's mutexPriority
+    std::atomic<long long> bottomLevel; // tasks on the longest path from here to a sink of the graph so far
+
+    // per-task dependencies, see runAsyncWithTaskDeps()
+    EdgeList taskSuccessors;            // launches whose tasks wait on tasks of this one
+    std::atomic<int> taskEdgeState;     // per-task edges being added to this launch, -1 once a chunk finished
+    std::vector<TaskDep> taskDeps;      // mappings of this launch's per-task dependencies
+    std::unique_ptr<std::atomic<int>[]> taskPending;    // per task: unfinished inputs, +1 until the launch is ready
+    int taskPendingCapacity;
+    bool perTask;                       // tasks are released one by one through taskPending
+
+    LaunchRecord(): tag(-1), runner(nullptr), id(-1), totalTask(0), remainingTasks(0), pendingDeps(0), waiters(0),
+                    helpers(0), scope(nullptr), bottomLevel(0), taskEdgeState(0), taskPendingCapacity(0), perTask(false) {}
+
+    static long long liveTag(TaskID id) { return 2 * (long long)id; }
+    static long long retiredTag(TaskID id) { return 2 * (long long)id + 1; }
+};
+
+/*
+ * LaunchTable: maps TaskIDs to LaunchRecords.  Launch `id` lives in slot
+ * id % capacity of a ring.  Lookups are lock free.  When the slot a new
+ * launch maps to is still held by a live launch, a ring of twice the
+ * capacity is appended and serves every id from then on; older rings
+ * keep serving the ids they already hold, so nothing is moved and no
+ * thread is stopped while the table grows.
+ */
+class LaunchTable {
+    public:
+        LaunchTable(int log_capacity = 8): numRings(0) {
+            for (int i = 0; i < kMaxRings; i++) {
+                rings[i].store(nullptr, std::memory_order_relaxed);
+            }
+            addRing(0, int64_t(1) << log_capacity);
+        }
+        ~LaunchTable() {
+            for (int i = 0; i < numRings.load(); i++) {
+                Ring* ring = rings[i].load();
+                delete[] ring->slots;
+                delete ring;
+            }
+        }
+
+        // slot that holds (or held) launch `id`
+        LaunchRecord* find(TaskID id) {
+            Ring* ring = ringFor(id);
+            return &ring->slots[id & ring->mask];
+        }
+
+        bool isDone(TaskID id) {
+            return find(id)->tag.load(std::memory_order_acquire) >= LaunchRecord::retiredTag(id);
+        }
+
+        /*
+         * Returns a free slot for the new launch `id`.  The caller fills
+         * it in and publishes it by storing its live tag.
+         */
+        LaunchRecord* acquire(TaskID id) {
+            while (true) {
+                int n = numRings.load(std::memory_order_acquire);
+                Ring* ring = ringFor(id);
+                LaunchRecord* slot = &ring->slots[id & ring->mask];
+                if (slot->tag.load(std::memory_order_acquire) & 1) {
+                    return slot;
+                }
+                if (ring == rings[n - 1].load(std::memory_order_acquire)) {
+                    std::lock_guard<std::mutex> lock(mutexGrow);
+                    if (numRings.load(std::memory_order_relaxed) == n) {
+                        addRing(id, 2 * (ring->mask + 1));
+                    }
+                } else {
+                    // the id belongs to an older ring: its previous
+                    // occupant is an earlier launch and will retire
+                    cpuRelax();
+                }
+            }
+        }
+
+        int64_t capacity() {
+            return rings[numRings.load() - 1].load()->mask + 1;
+        }
+
+        // rings added after the initial one
+        long growCount() {
+            return numRings.load() - 1;
+        }
+
+    private:
+        struct Ring {
+            TaskID firstId;     // first id served by this ring
+            int64_t mask;
+            LaunchRecord* slots;
+        };
+        static const int kMaxRings = 32;
+
+        Ring* ringFor(TaskID id) {
+            int i = numRings.load(std::memory_order_acquire) - 1;
+            Ring* ring = rings[i].load(std::memory_order_acquire);
+            while (ring->firstId > id && i > 0) {
+                ring = rings[--i].load(std::memory_order_acquire);
+            }
+            return ring;
+        }
+
+        void addRing(TaskID firstId, int64_t capacity) {
+            Ring* ring = new Ring;
+            ring->firstId = firstId;
+            ring->mask = capacity - 1;
+            ring->slots = new LaunchRecord[capacity];
+            int n = numRings.load(std::memory_order_relaxed);
+            rings[n].store(ring, std::memory_order_release);
+            numRings.store(n + 1, std::memory_order_release);
+        }
+
+        std::atomic<Ring*> rings[kMaxRings];
+        std::atomic<int> numRings;
+        std::mutex mutexGrow;
+};
+
+#endif
@@ -0,0 +1,103 @@
+#ifndef _MPMCQUEUE_H
+#define _MPMCQUEUE_H
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+
+/*
+ * MpmcQueue: bounded lock-free multi-producer multi-consumer FIFO, after
+ * Dmitry Vyukov's bounded MPMC queue.  Every cell of the ring carries a
+ * sequence number saying whose turn it is: a producer may fill cell
+ * pos & mask once its sequence equals pos, a consumer may empty it once
+ * the sequence equals pos + 1.  A thread claims a position with one CAS
+ * on the shared enqueue or dequeue counter and then owns the cell, so
+ * producers never wait for consumers or for each other beyond a CAS
+ * retry, and a thread stalled mid-operation only holds up its own cell.
+ *
+ * tryPush() fails when the ring is full and tryPop() when it is empty;
+ * neither blocks.  T must be default constructible and copyable.
+ */
+template <typename T>
+class MpmcQueue {
+    public:
+        MpmcQueue(int log_capacity = 10): mask((size_t(1) << log_capacity) - 1) {
+            cells = new Cell[mask + 1];
+            for (size_t i = 0; i <= mask; i++) {
+                cells[i].sequence.store(i, std::memory_order_relaxed);
+            }
+            enqueuePos.store(0, std::memory_order_relaxed);
+            dequeuePos.store(0, std::memory_order_relaxed);
+        }
+        ~MpmcQueue() { delete[] cells; }
+        MpmcQueue(const MpmcQueue&) = delete;
+        MpmcQueue& operator=(const MpmcQueue&) = delete;
+
+        bool tryPush(const T& item) {
+            size_t pos = enqueuePos.load(std::memory_order_relaxed);
+            Cell* cell;
+            while (true) {
+                cell = &cells[pos & mask];
+                size_t seq = cell->sequence.load(std::memory_order_acquire);
+                intptr_t diff = (intptr_t)seq - (intptr_t)pos;
+                if (diff == 0) {
+                    if (enqueuePos.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed)) {
+                        break;
+                    }
+                } else if (diff < 0) {
+                    // the cell still holds the item of the previous lap
+                    return false;
+                } else {
+                    pos = enqueuePos.load(std::memory_order_relaxed);
+                }
+            }
+            cell->item = item;
+            cell->sequence.store(pos + 1, std::memory_order_release);
+            return true;
+        }
+
+        bool tryPop(T& item) {
+            size_t pos = dequeuePos.load(std::memory_order_relaxed);
+            Cell* cell;
+            while (true) {
+                cell = &cells[pos & mask];
+                size_t seq = cell->sequence.load(std::memory_order_acquire);
+                intptr_t diff = (intptr_t)seq - (intptr_t)(pos + 1);
+                if (diff == 0) {
+                    if (dequeuePos.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed)) {
+                        break;
+                    }
+                } else if (diff < 0) {
+                    // not filled yet in this lap
+                    return false;
+                } else {
+                    pos = dequeuePos.load(std::memory_order_relaxed);
+                }
+            }
+            item = cell->item;
+            cell->sequence.store(pos + mask + 1, std::memory_order_release);
+            return true;
+        }
+
+        // approximate number of queued items, for statistics only
+        int64_t size() const {
+            int64_t n = (int64_t)(enqueuePos.load(std::memory_order_relaxed) -
+                                  dequeuePos.load(std::memory_order_relaxed));
+            return n > 0 ? n : 0;
+        }
+
+        int64_t capacity() const { return (int64_t)mask + 1; }
+
+    private:
+        struct Cell {
+            std::atomic<size_t> sequence;
+            T item;
+        };
+
+        size_t mask;
+        Cell* cells;
+        alignas(64) std::atomic<size_t> enqueuePos;
+        alignas(64) std::atomic<size_t> dequeuePos;
+};
+
+#endif
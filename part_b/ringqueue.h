@@ -0,0 +1,55 @@
+#ifndef _RINGQUEUE_H
+#define _RINGQUEUE_H
+
+#include <cstdint>
+
+/*
+ * RingQueue: FIFO queue on a power-of-two ring buffer.  Unlike
+ * std::queue it never gives memory back, so once the ring has grown to
+ * the largest backlog seen, push() and pop() do not touch the heap.
+ * Not thread safe; callers provide their own locking.
+ */
+template <typename T>
+class RingQueue {
+    public:
+        RingQueue(int log_capacity = 6): head(0), tail(0), mask((int64_t(1) << log_capacity) - 1), grows(0) {
+            items = new T[mask + 1];
+        }
+        ~RingQueue() { delete[] items; }
+
+        bool empty() const { return head == tail; }
+        int64_t size() const { return tail - head; }
+        T& front() { return items[head & mask]; }
+        void pop() { head++; }
+
+        void push(const T& item) {
+            if (tail - head > mask) {
+                grow();
+            }
+            items[tail & mask] = item;
+            tail++;
+        }
+
+        // times the ring had to be reallocated
+        long growCount() const { return grows; }
+
+    private:
+        void grow() {
+            T* bigger = new T[2 * (mask + 1)];
+            int64_t biggerMask = 2 * (mask + 1) - 1;
+            for (int64_t i = head; i < tail; i++) {
+                bigger[i & biggerMask] = items[i & mask];
+            }
+            delete[] items;
+            items = bigger;
+            mask = biggerMask;
+            grows++;
+        }
+
+        int64_t head, tail;
+        int64_t mask;
+        T* items;
+        long grows;
+};
+
+#endif
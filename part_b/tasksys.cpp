@@ -1,11 +1,79 @@
 #include "tasksys.h"
+#include <algorithm>
+#include <cstdio>
+#include <type_traits>
 
 
 IRunnable::~IRunnable() {}
 
+void IRunnable::runTaskRange(int begin, int end, int num_total_tasks) {
+    for (int i = begin; i < end; i++) {
+        runTask(i, num_total_tasks);
+    }
+}
+
 ITaskSystem::ITaskSystem(int num_threads) {}
 ITaskSystem::~ITaskSystem() {}
 
+void ITaskSystem::wait(TaskID task) {
+    sync();
+}
+
+bool ITaskSystem::waitFor(TaskID task, std::chrono::microseconds timeout) {
+    sync();
+    return true;
+}
+
+bool ITaskSystem::isDone(TaskID task) {
+    return true;
+}
+
+TaskID ITaskSystem::runAsyncWithTaskDeps(IRunnable* runnable, int num_total_tasks,
+                                         const std::vector<TaskDep>& deps, const Schedule& schedule) {
+    std::vector<TaskID> ids;
+    for (const TaskDep& dep : deps) {
+        ids.push_back(dep.id);
+    }
+    return runAsyncWithDeps(runnable, num_total_tasks, ids, schedule);
+}
+
+TaskID ITaskSystem::runGraph(const TaskGraph& graph, const std::vector<TaskID>& deps) {
+    std::vector<TaskID> ids(graph.size());
+    std::vector<TaskID> nodeDeps;
+    for (int i = 0; i < graph.size(); i++) {
+        const TaskGraphNode& node = graph.node(i);
+        nodeDeps.clear();
+        if (node.numDeps == 0) {
+            nodeDeps = deps;
+        }
+        for (int k = 0; k < node.numDeps; k++) {
+            nodeDeps.push_back(ids[graph.deps(i)[k]]);
+        }
+        ids[i] = runAsyncWithDeps(node.runner, node.numTasks, nodeDeps, node.schedule);
+    }
+    return ids.back();
+}
+
+std::vector<TaskID> ITaskSystem::submitBatch(const std::vector<LaunchDesc>& launches) {
+    std::vector<TaskID> ids(launches.size());
+    std::vector<TaskID> launchDeps;
+    for (size_t i = 0; i < launches.size(); i++) {
+        const LaunchDesc& desc = launches[i];
+        launchDeps = desc.deps;
+        for (int dep : desc.batch_deps) {
+            if (dep >= 0 && (size_t)dep < i) {
+                launchDeps.push_back(ids[dep]);
+            }
+        }
+        ids[i] = runAsyncWithDeps(desc.runnable, desc.num_total_tasks, launchDeps, desc.schedule);
+    }
+    return ids;
+}
+
+TaskSystemStats ITaskSystem::getStats() {
+    return TaskSystemStats();
+}
+
 /*
  * ================================================================
  * Serial task system implementation
@@ -21,17 +89,14 @@ TaskSystemSerial::TaskSystemSerial(int num_threads): ITaskSystem(num_threads) {
 
 TaskSystemSerial::~TaskSystemSerial() {}
 
-void TaskSystemSerial::run(IRunnable* runnable, int num_total_tasks) {
-    for (int i = 0; i < num_total_tasks; i++) {
-        runnable->runTask(i, num_total_tasks);
-    }
+void TaskSystemSerial::run(IRunnable* runnable, int num_total_tasks, const Schedule& schedule) {
+    runnable->runTaskRange(0, num_total_tasks, num_total_tasks);
 }
 
 TaskID TaskSystemSerial::runAsyncWithDeps(IRunnable* runnable, int num_total_tasks,
-                                          const std::vector<TaskID>& deps) {
-    for (int i = 0; i < num_total_tasks; i++) {
-        runnable->runTask(i, num_total_tasks);
-    }
+                                          const std::vector<TaskID>& deps,
+                                          const Schedule& schedule) {
+    runnable->runTaskRange(0, num_total_tasks, num_total_tasks);
 
     return 0;
 }
@@ -50,25 +115,22 @@ const char* TaskSystemParallelSpawn::name() {
     return "Parallel + Always Spawn";
 }
 
-TaskSystemParallelSpawn::TaskSystemParallelSpawn(int num_threads): ITaskSystem(num_threads) {
+TaskSystemParallelSpawn::TaskSystemParallelSpawn(int num_threads, const TaskSystemOptions& options): ITaskSystem(num_threads) {
     // NOTE: CS149 students are not expected to implement TaskSystemParallelSpawn in Part B.
 }
 
 TaskSystemParallelSpawn::~TaskSystemParallelSpawn() {}
 
-void TaskSystemParallelSpawn::run(IRunnable* runnable, int num_total_tasks) {
+void TaskSystemParallelSpawn::run(IRunnable* runnable, int num_total_tasks, const Schedule& schedule) {
     // NOTE: CS149 students are not expected to implement TaskSystemParallelSpawn in Part B.
-    for (int i = 0; i < num_total_tasks; i++) {
-        runnable->runTask(i, num_total_tasks);
-    }
+    runnable->runTaskRange(0, num_total_tasks, num_total_tasks);
 }
 
 TaskID TaskSystemParallelSpawn::runAsyncWithDeps(IRunnable* runnable, int num_total_tasks,
-                                                 const std::vector<TaskID>& deps) {
+                                                 const std::vector<TaskID>& deps,
+                                                 const Schedule& schedule) {
     // NOTE: CS149 students are not expected to implement TaskSystemParallelSpawn in Part B.
-    for (int i = 0; i < num_total_tasks; i++) {
-        runnable->runTask(i, num_total_tasks);
-    }
+    runnable->runTaskRange(0, num_total_tasks, num_total_tasks);
 
     return 0;
 }
@@ -88,25 +150,22 @@ const char* TaskSystemParallelThreadPoolSpinning::name() {
     return "Parallel + Thread Pool + Spin";
 }
 
-TaskSystemParallelThreadPoolSpinning::TaskSystemParallelThreadPoolSpinning(int num_threads): ITaskSystem(num_threads) {
+TaskSystemParallelThreadPoolSpinning::TaskSystemParallelThreadPoolSpinning(int num_threads, const TaskSystemOptions& options): ITaskSystem(num_threads) {
     // NOTE: CS149 students are not expected to implement TaskSystemParallelThreadPoolSpinning in Part B.
 }
 
 TaskSystemParallelThreadPoolSpinning::~TaskSystemParallelThreadPoolSpinning() {}
 
-void TaskSystemParallelThreadPoolSpinning::run(IRunnable* runnable, int num_total_tasks) {
+void TaskSystemParallelThreadPoolSpinning::run(IRunnable* runnable, int num_total_tasks, const Schedule& schedule) {
     // NOTE: CS149 students are not expected to implement TaskSystemParallelThreadPoolSpinning in Part B.
-    for (int i = 0; i < num_total_tasks; i++) {
-        runnable->runTask(i, num_total_tasks);
-    }
+    runnable->runTaskRange(0, num_total_tasks, num_total_tasks);
 }
 
 TaskID TaskSystemParallelThreadPoolSpinning::runAsyncWithDeps(IRunnable* runnable, int num_total_tasks,
-                                                              const std::vector<TaskID>& deps) {
+                                                              const std::vector<TaskID>& deps,
+                                                              const Schedule& schedule) {
     // NOTE: CS149 students are not expected to implement TaskSystemParallelThreadPoolSpinning in Part B.
-    for (int i = 0; i < num_total_tasks; i++) {
-        runnable->runTask(i, num_total_tasks);
-    }
+    runnable->runTaskRange(0, num_total_tasks, num_total_tasks);
 
     return 0;
 }
@@ -122,91 +181,1642 @@ void TaskSystemParallelThreadPoolSpinning::sync() {
  * ================================================================
  */
 
-const char* TaskSystemParallelThreadPoolSleeping::name() {
-    return "Parallel + Thread Pool + Sleep";
+// worker identity of the current thread, used to route launches made
+// ready by a worker onto that worker's own deque
+static thread_local ITaskSystem* tlsPool = nullptr;
+static thread_local int tlsWorkerId = -1;
+// scope of the task the current thread is running, null outside tasks
+static thread_local TaskScope* tlsScope = nullptr;
+
+static inline long long steadyNanos() {
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(
+        std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+template <typename Lock>
+const char* BasicTaskSystemParallelThreadPoolSleeping<Lock>::name() {
+    return displayName.c_str();
 }
 
-TaskSystemParallelThreadPoolSleeping::TaskSystemParallelThreadPoolSleeping(int num_threads): ITaskSystem(num_threads) {
-    maxThread = num_threads;
+template <typename Lock>
+BasicTaskSystemParallelThreadPoolSleeping<Lock>::BasicTaskSystemParallelThreadPoolSleeping(int num_threads, const TaskSystemOptions& options): ITaskSystem(num_threads) {
+    maxThread = resolveThreadCount(num_threads);
     workers.reserve(maxThread);
     stop = false;
-    finishedTask = -1;
     nextTaskId = 0;
-    for (int i = 0; i < maxThread; i++) {
-        workers.emplace_back(std::thread(&TaskSystemParallelThreadPoolSleeping::workerFunc, this));
+    readyTasks = 0;
+    submitOverflows = 0;
+    taskBufferGrows = 0;
+    readyHeapGrows = 0;
+    priorityStackGrows = 0;
+    pendingLevelSeeds = 0;
+    readyOrderStale = false;
+    frontLane = -1;
+    agingNs = (long long)std::max(0, options.priority_aging_us) * 1000;
+    readyUrgent = 0;
+    numSleepers = 0;
+    numSearching = 0;
+    wakeTokens = 0;
+    wakeSignals = 0;
+    lazySplit = options.lazy_split;
+    workStealing = options.work_stealing || lazySplit;
+    verbose = options.verbose;
+    stats = options.stats;
+    maxSpin = std::max(0, options.max_spin);
+    helpOnSync = options.help_on_sync;
+    helperSlotTaken = false;
+    criticalPath = options.critical_path;
+    displayName = "Parallel + Thread Pool + Sleep";
+    if (criticalPath) {
+        displayName += " + Critical Path";
+    }
+    if (!std::is_same<Lock, std::mutex>::value) {
+        displayName += std::string(" + ") + lockName<Lock>() + " lock";
+    }
+    if (criticalPath) {
+        for (int i = 0; i < NUM_PRIORITIES; i++) {
+            readyHeaps[i].reserve(64);
+        }
+        priorityStack.reserve(64);
+    }
+    unfinishedLaunches = 0;
+    numSlots = maxThread + 1;
+    workerStates.reset(new WorkerState[numSlots]);
+    for (int i = 0; i < numSlots; i++) {
+        workerStates[i].rngState = 2 * i + 1;
+        workerStates[i].spinBudget = maxSpin;
+    }
+    elastic = options.elastic;
+    minThread = elastic ? std::min(maxThread, std::max(1, options.min_threads)) : maxThread;
+    growDelayNs = (long long)std::max(0, options.grow_delay_us) * 1000;
+    idleTimeout = std::chrono::microseconds(std::max(0, options.idle_timeout_us));
+    numWorkers = 0;
+    backlogSince = 0;
+    spawns = 0;
+    retires = 0;
+    placement = CpuTopology::get().placement(options.pin_policy, maxThread, options.pin_cpus);
+    workers.resize(maxThread);
+    for (int i = 0; i < minThread; i++) {
+        startWorker(i);
     }
 }
 
-TaskSystemParallelThreadPoolSleeping::~TaskSystemParallelThreadPoolSleeping() {
+template <typename Lock>
+BasicTaskSystemParallelThreadPoolSleeping<Lock>::~BasicTaskSystemParallelThreadPoolSleeping() {
     stop = true;
-    for (auto& t : workers) {
-        t.join();
+    {
+        std::lock_guard<std::mutex> lock(mutexSleep);
+        cvWake.notify_all();
+    }
+    // a worker may still be spawning one; stop keeps any later spawn out
+    std::vector<std::thread> threads;
+    {
+        std::lock_guard<Lock> lock(mutexElastic);
+        threads.swap(workers);
+    }
+    for (auto& t : threads) {
+        if (t.joinable()) {
+            t.join();
+        }
+    }
+    if (verbose) {
+        long attempts = 0, steals = 0, parks = 0, wakeups = 0, splits = 0;
+        for (int i = 0; i < maxThread; i++) {
+            WorkerState& w = workerStates[i];
+            attempts += w.counters.get(STAT_STEAL_ATTEMPTS);
+            steals += w.counters.get(STAT_STEALS);
+            parks += w.parks;
+            wakeups += w.counters.get(STAT_WAKEUPS);
+            splits += w.splits;
+            printf("  worker %d: %lld steals / %lld attempts, %ld parks, %lld wakeups, %ld spin hits, %ld splits, spin budget %d\n",
+                   i, w.counters.get(STAT_STEALS), w.counters.get(STAT_STEAL_ATTEMPTS), w.parks.load(),
+                   w.counters.get(STAT_WAKEUPS), w.spinHits.load(), w.splits.load(), w.spinBudget);
+        }
+        printf("  total: %ld steals / %ld attempts, %ld parks, %ld wakeups, %ld wake signals, %ld splits\n",
+               steals, attempts, parks, wakeups, wakeSignals.load(), splits);
+        if (elastic) {
+            printf("  elastic: %d to %d workers, %ld spawned, %ld retired\n",
+                   minThread, maxThread, spawns.load(), retires.load());
+        }
+        printf("  submit queue: capacity %ld, %ld pushes overflowed to the lock\n",
+               (long)submitQueue.capacity(), submitOverflows.load());
+
+        // every heap allocation the submission path can make after
+        // construction is one of these growth events
+        long allocations = launchTable.growCount() + readyHeapGrows + priorityStackGrows +
+                           edgePool.growCount() + predecessorPool.growCount() + taskBufferGrows.load();
+        for (int i = 0; i < NUM_PRIORITIES; i++) {
+            allocations += readyQueues[i].growCount();
+        }
+        for (int i = 0; i < numSlots; i++) {
+            allocations += workerStates[i].deque.growCount();
+        }
+        long launches = nextTaskId.load();
+        printf("  %ld launches, %ld allocations after setup (%.4f per launch), launch table capacity %ld\n",
+               launches, allocations, launches > 0 ? (double)allocations / launches : 0.0,
+               (long)launchTable.capacity());
+    }
+}
+
+/*
+ * Called once all dependencies of `launch` are done.  A worker of the
+ * work-stealing engine keeps the launch on its own deque; everything
+ * else goes through the shared ready queue.  Under critical-path
+ * scheduling every launch goes through the ready queue, since a local
+ * deque would run it ahead of more urgent launches.
+ */
+template <typename Lock>
+void BasicTaskSystemParallelThreadPoolSleeping<Lock>::makeReady(LaunchRecord* launch) {
+    if (launch->perTask) {
+        // drop the hold every task counter had until now
+        releaseTasks(launch, 0, launch->totalTask, [](int task) { return 1; });
+        return;
+    }
+    wakeWorkers(queueLaunch(launch));
+}
+
+/*
+ * makeReady() for a launch without per-task dependencies, leaving the
+ * wakeup to the caller: returns the number of workers to wake, so a
+ * submission that releases several launches wakes workers once.
+ */
+template <typename Lock>
+int BasicTaskSystemParallelThreadPoolSleeping<Lock>::queueLaunch(LaunchRecord* launch) {
+    if (launch->totalTask == 0) {
+        finishTasks(launch, 1);
+        return 0;
+    }
+    return queueRange(launch, 0, launch->totalTask);
+}
+
+/*
+ * Hands out tasks [begin, end) of `launch` and returns the number of
+ * workers to wake for them; only the ready queue orders launches by
+ * priority class, so other classes skip the deques.
+ *
+ * Submitters go through submitQueue, a lock-free MPMC ring, instead of
+ * taking mutexReadyQueue, which the claiming workers hold; the next
+ * claim moves the ring's contents into the lanes.  The counters are
+ * raised before the push, so they never drop below the tasks that are
+ * actually queued.  Only a full ring falls back to the lock.
+ */
+template <typename Lock>
+int BasicTaskSystemParallelThreadPoolSleeping<Lock>::queueRange(LaunchRecord* launch, int begin, int end) {
+    if (workStealing && !criticalPath && tlsPool == this && launch->schedule.priority == PRIORITY_NORMAL) {
+        TaskRange range = {launch, begin, end};
+        workerStates[tlsWorkerId].deque.push(range);
+        return 1;
+    }
+    ReadyTask task(launch, begin, end);
+    if (agingNs > 0) {
+        task.readySince = steadyNanos();
+    }
+    if (launch->schedule.priority == PRIORITY_HIGH) {
+        readyUrgent.fetch_add(end - begin, std::memory_order_relaxed);
+    }
+    // a work-stealing launch is one range until it is split.  Counted
+    // before the push: once queued, the launch may finish and its slot
+    // be reused by another submitter
+    int wake = workStealing ? 1 : readyChunks(launch, end - begin);
+    readyTasks.fetch_add(end - begin, std::memory_order_relaxed);
+    if (!submitQueue.tryPush(task)) {
+        submitOverflows.fetch_add(1, std::memory_order_relaxed);
+        CountedLockGuard<Lock> lock(mutexReadyQueue, localCounters());
+        // keep FIFO order with the launches still in the ring
+        drainSubmissions();
+        pushReady(task);
+    }
+    return wake;
+}
+
+/*
+ * Schedules: SCHEDULE_AUTO hands out one task per claim from the ready
+ * queue and splits work-stealing ranges down to a grain of a quarter of
+ * the launch per worker.  Other kinds size both the claims and the
+ * grain with scheduleChunk(), counting every worker slot, the thread
+ * inside sync() included, as a thread of the launch.  No thread owns a
+ * block, so SCHEDULE_STATIC fixes the chunks but not who runs them.
+ */
+template <typename Lock>
+int BasicTaskSystemParallelThreadPoolSleeping<Lock>::readyChunks(LaunchRecord* launch, int count) {
+    if (launch->schedule.kind == SCHEDULE_AUTO) {
+        return count;
+    }
+    int chunk = scheduleChunk(launch->schedule, count, launch->totalTask, numSlots);
+    return (count + chunk - 1) / chunk;
+}
+
+/*
+ * Records that `count` tasks of `launch` finished.  The thread that
+ * finishes the last task releases the successors whose last pending
+ * dependency it was and then retires the launch, which frees its slot
+ * in launchTable for reuse.
+ *
+ * Dependents register under the record's lock only while tasks remain,
+ * so taking the lock once after the count hits zero closes the
+ * successor list.
+ */
+template <typename Lock>
+void BasicTaskSystemParallelThreadPoolSleeping<Lock>::finishTasks(LaunchRecord* launch, int count) {
+    if (launch->remainingTasks.fetch_sub(count, std::memory_order_acq_rel) != count) {
+        return;
+    }
+    launch->lock.lock();
+    launch->lock.unlock();
+    if (!launch->successors.empty()) {
+        for (EdgeNode* node = launch->successors.first; node != nullptr; node = node->next) {
+            if (node->launch->pendingDeps.fetch_sub(1, std::memory_order_acq_rel) == 1) {
+                makeReady(node->launch);
+            }
+        }
+        edgePool.release(launch->successors);
+        launch->successors.clear();
+    }
+    if (!launch->taskSuccessors.empty()) {
+        // per-task successors were kept from retiring while this launch
+        // could still read their mappings
+        for (EdgeNode* node = launch->taskSuccessors.first; node != nullptr; node = node->next) {
+            finishTasks(node->launch, 1);
+        }
+        edgePool.release(launch->taskSuccessors);
+        launch->taskSuccessors.clear();
+    }
+
+    TaskScope* scope = launch->scope;
+    launch->lock.lock();
+    launch->tag.store(LaunchRecord::retiredTag(launch->id), std::memory_order_release);
+    int waiters = launch->waiters;
+    int helpers = launch->helpers;
+    launch->waiters = 0;
+    launch->helpers = 0;
+    launch->lock.unlock();
+    if (waiters > 0) {
+        std::lock_guard<std::mutex> lock(mutexWait);
+        launchFinished.notify_all();
+    }
+    // helping waiters sleep on cvWake; the scope may be gone as soon as
+    // its count hits zero, so it is not touched after the decrement
+    bool wakeHelpers = helpers > 0;
+    if (scope != nullptr && scope->pending.fetch_sub(1, std::memory_order_acq_rel) == 1) {
+        wakeHelpers = true;
+    }
+    if (wakeHelpers) {
+        std::lock_guard<std::mutex> lock(mutexSleep);
+        cvWake.notify_all();
+    }
+
+    // successors are still counted, so this only hits zero once the graph drained
+    if (unfinishedLaunches.fetch_sub(1, std::memory_order_acq_rel) == 1) {
+        std::lock_guard<std::mutex> lock(mutexWait);
+        finished.notify_all();
+    }
+}
+
+/*
+ * Idle policy: a worker that finds no work polls up to its spin budget,
+ * issuing a pause/yield hint between polls, and then parks on cvWake.
+ * The budget adapts per worker: work that shows up while spinning
+ * raises it to twice the polls it took, a wasted spin halves it.
+ */
+template <typename Lock>
+bool BasicTaskSystemParallelThreadPoolSleeping<Lock>::hasWork() {
+    if (readyTasks.load(std::memory_order_relaxed) > 0) {
+        return true;
+    }
+    if (workStealing) {
+        for (int i = 0; i < numSlots; i++) {
+            if (workerStates[i].deque.size() > 0) {
+                return true;
+            }
+        }
+    }
+    return false;
+}
+
+/*
+ * With stats, `pollStart` is when the worker began the look for work
+ * that failed; the look and the pause after it count as spinning.
+ * Returns false when the worker retired instead of going back to work.
+ */
+template <typename Lock>
+bool BasicTaskSystemParallelThreadPoolSleeping<Lock>::idle(int workerId, int& idleSpins, long long pollStart) {
+    WorkerState& self = workerStates[workerId];
+    if (idleSpins < self.spinBudget) {
+        idleSpins++;
+        cpuRelax();
+        if (stats) {
+            self.counters.add(STAT_SPIN_NS, statNanos() - pollStart);
+        }
+        return true;
+    }
+    if (stats) {
+        self.counters.add(STAT_SPIN_NS, statNanos() - pollStart);
+    }
+    setSearching(workerId, false);
+    if (!park(workerId)) {
+        return false;
+    }
+    self.spinBudget = std::min(maxSpin, std::max(16, self.spinBudget / 2));
+    idleSpins = 0;
+    return true;
+}
+
+static inline void spinHit(WorkerState& self, int& idleSpins, int maxSpin) {
+    if (idleSpins > 0) {
+        self.spinHits.fetch_add(1, std::memory_order_relaxed);
+        self.spinBudget = std::min(maxSpin, std::max(self.spinBudget, 2 * idleSpins));
+        idleSpins = 0;
     }
 }
 
-void TaskSystemParallelThreadPoolSleeping::workerFunc() {
+/*
+ * numSleepers is raised before the last look for work, and wakers fence
+ * after publishing work before reading it, so either the sleeper sees
+ * the work or the waker sees the sleeper.
+ *
+ * A worker of the elastic pool that sleeps through idleTimeout without
+ * a signal retires, unless the pool is down to minThread workers.  Its
+ * deque is empty, since only its owner pushes to it and the owner found
+ * no work before parking.  Returns false when the worker retired.
+ */
+template <typename Lock>
+bool BasicTaskSystemParallelThreadPoolSleeping<Lock>::park(int workerId) {
+    WorkerState& self = workerStates[workerId];
+    std::unique_lock<std::mutex> lock(mutexSleep);
+    numSleepers.fetch_add(1, std::memory_order_seq_cst);
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    bool keep = true;
+    if (!stop && !hasWork()) {
+        self.parks.fetch_add(1, std::memory_order_relaxed);
+        StatTimer parked(localCounters(), STAT_PARKED_NS);
+        auto woken = [this] { return wakeTokens > 0 || stop; };
+        if (!elastic) {
+            cvWake.wait(lock, woken);
+        }
+        while (!woken() && !cvWake.wait_for(lock, idleTimeout, woken)) {
+            int live = numWorkers.load(std::memory_order_relaxed);
+            while (live > minThread &&
+                   !numWorkers.compare_exchange_weak(live, live - 1, std::memory_order_relaxed)) {
+            }
+            if (live > minThread) {
+                keep = false;
+                break;
+            }
+        }
+        if (keep && wakeTokens > 0) {
+            wakeTokens--;
+            self.counters.add(STAT_WAKEUPS);
+        }
+    }
+    numSleepers.fetch_sub(1, std::memory_order_relaxed);
+    return keep;
+}
+
+template <typename Lock>
+void BasicTaskSystemParallelThreadPoolSleeping<Lock>::wakeWorkers(int count) {
+    if (count <= 0) {
+        return;
+    }
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    if (numSleepers.load(std::memory_order_seq_cst) == 0) {
+        if (elastic) {
+            noteBacklog();
+        }
+        return;
+    }
+    int n;
+    {
+        std::lock_guard<std::mutex> lock(mutexSleep);
+        n = std::min(count, numSleepers.load(std::memory_order_relaxed) - wakeTokens);
+        for (int i = 0; i < n; i++) {
+            wakeTokens++;
+            cvWake.notify_one();
+        }
+    }
+    if (n > 0) {
+        wakeSignals.fetch_add(n, std::memory_order_relaxed);
+    }
+    if (elastic && n < count) {
+        noteBacklog();
+    }
+}
+
+/*
+ * Elastic pool growth.  Work that finds no parked worker to wake starts
+ * the backlog clock; a worker that runs out of work stops it.  Once the
+ * backlog is older than growDelayNs, the next thread to finish a chunk
+ * or submit work adds one worker and restarts the clock, so a pool that
+ * stays saturated grows by a worker per delay up to maxThread.
+ */
+template <typename Lock>
+void BasicTaskSystemParallelThreadPoolSleeping<Lock>::noteBacklog() {
+    if (numWorkers.load(std::memory_order_relaxed) >= maxThread) {
+        return;
+    }
+    if (backlogSince.load(std::memory_order_relaxed) == 0) {
+        long long none = 0;
+        backlogSince.compare_exchange_strong(none, steadyNanos(), std::memory_order_relaxed);
+        return;
+    }
+    maybeGrow();
+}
+
+template <typename Lock>
+void BasicTaskSystemParallelThreadPoolSleeping<Lock>::maybeGrow() {
+    long long since = backlogSince.load(std::memory_order_relaxed);
+    if (since == 0) {
+        return;
+    }
+    long long now = steadyNanos();
+    if (now - since < growDelayNs || !backlogSince.compare_exchange_strong(since, 0, std::memory_order_relaxed)) {
+        return;
+    }
+    if (!hasWork()) {
+        return;
+    }
+    {
+        std::lock_guard<Lock> lock(mutexElastic);
+        if (stop) {
+            return;
+        }
+        for (int i = 0; i < maxThread; i++) {
+            if (!workerStates[i].attached) {
+                startWorker(i);
+                spawns.fetch_add(1, std::memory_order_relaxed);
+                break;
+            }
+        }
+    }
+    if (numWorkers.load(std::memory_order_relaxed) < maxThread) {
+        long long none = 0;
+        backlogSince.compare_exchange_strong(none, now, std::memory_order_relaxed);
+    }
+}
+
+// starts a thread in the free slot `workerId`; mutexElastic is held
+// except during construction
+template <typename Lock>
+void BasicTaskSystemParallelThreadPoolSleeping<Lock>::startWorker(int workerId) {
+    WorkerState& slot = workerStates[workerId];
+    if (workers[workerId].joinable()) {
+        // the slot's previous thread retired and is on its way out
+        workers[workerId].join();
+    }
+    slot.attached = true;
+    slot.spinBudget = maxSpin;
+    numWorkers.fetch_add(1, std::memory_order_relaxed);
+    workers[workerId] = std::thread(&BasicTaskSystemParallelThreadPoolSleeping<Lock>::workerFunc, this, workerId);
+    if (!placement.empty()) {
+        pinThread(workers[workerId], placement[workerId]);
+    }
+}
+
+/*
+ * Ready queue access, all under mutexReadyQueue.  Each priority class
+ * has its own lane, FIFO by default and a max-heap on the launches'
+ * bottom levels under critical-path scheduling.  Heap keys are
+ * snapshots: when a submission raises the bottom level of a queued
+ * launch the heaps are rebuilt on the next access.
+ *
+ * Claims come from the highest class with ready work.  With aging, a
+ * lane's front instead competes as if it were one class higher for
+ * every agingNs it has been queued, so a saturating stream of urgent
+ * launches delays a queued launch by a bounded time, not forever.
+ */
+template <typename Lock>
+void BasicTaskSystemParallelThreadPoolSleeping<Lock>::pushReady(ReadyTask task) {
+    int lane = task.launch->schedule.priority;
+    if (!criticalPath) {
+        readyQueues[lane].push(task);
+        return;
+    }
+    std::vector<ReadyTask>& heap = readyHeaps[lane];
+    task.level = task.launch->bottomLevel.load(std::memory_order_relaxed);
+    if (heap.size() == heap.capacity()) {
+        readyHeapGrows++;
+    }
+    heap.push_back(task);
+    std::push_heap(heap.begin(), heap.end(), ReadyTaskOrder());
+}
+
+// moves submitted launches into their lanes
+template <typename Lock>
+void BasicTaskSystemParallelThreadPoolSleeping<Lock>::drainSubmissions() {
+    ReadyTask task;
+    while (submitQueue.tryPop(task)) {
+        pushReady(task);
+    }
+}
+
+// lane to claim from next, -1 if all are empty
+template <typename Lock>
+int BasicTaskSystemParallelThreadPoolSleeping<Lock>::pickLane() {
+    int best = -1;
+    int queued = 0;
+    for (int lane = NUM_PRIORITIES - 1; lane >= 0; lane--) {
+        if (criticalPath ? !readyHeaps[lane].empty() : !readyQueues[lane].empty()) {
+            if (best < 0) {
+                best = lane;
+            }
+            queued++;
+        }
+    }
+    if (queued < 2 || agingNs == 0) {
+        return best;
+    }
+    long long now = steadyNanos();
+    long long bestRank = 0;
+    best = -1;
+    for (int lane = NUM_PRIORITIES - 1; lane >= 0; lane--) {
+        const ReadyTask* front;
+        if (criticalPath) {
+            if (readyHeaps[lane].empty()) {
+                continue;
+            }
+            front = &readyHeaps[lane].front();
+        } else {
+            if (readyQueues[lane].empty()) {
+                continue;
+            }
+            front = &readyQueues[lane].front();
+        }
+        long long rank = lane * agingNs + (now - front->readySince);
+        if (best < 0 || rank > bestRank) {
+            best = lane;
+            bestRank = rank;
+        }
+    }
+    return best;
+}
+
+template <typename Lock>
+ReadyTask* BasicTaskSystemParallelThreadPoolSleeping<Lock>::frontReady() {
+    drainSubmissions();
+    if (criticalPath && readyOrderStale.exchange(false, std::memory_order_acquire)) {
+        for (std::vector<ReadyTask>& heap : readyHeaps) {
+            for (ReadyTask& task : heap) {
+                task.level = task.launch->bottomLevel.load(std::memory_order_relaxed);
+            }
+            std::make_heap(heap.begin(), heap.end(), ReadyTaskOrder());
+        }
+    }
+    frontLane = pickLane();
+    if (frontLane < 0) {
+        return nullptr;
+    }
+    return criticalPath ? &readyHeaps[frontLane].front() : &readyQueues[frontLane].front();
+}
+
+// pops the launch frontReady() returned
+template <typename Lock>
+void BasicTaskSystemParallelThreadPoolSleeping<Lock>::popReady() {
+    if (!criticalPath) {
+        readyQueues[frontLane].pop();
+        return;
+    }
+    std::vector<ReadyTask>& heap = readyHeaps[frontLane];
+    std::pop_heap(heap.begin(), heap.end(), ReadyTaskOrder());
+    heap.pop_back();
+}
+
+template <typename Lock>
+bool BasicTaskSystemParallelThreadPoolSleeping<Lock>::claimReadyTask(LaunchRecord*& launch, int& begin, int& end) {
+    if (readyTasks.load(std::memory_order_relaxed) == 0) {
+        return false;
+    }
+    CountedLockGuard<Lock> lock(mutexReadyQueue, localCounters());
+    ReadyTask* task = frontReady();
+    if (task == nullptr) {
+        return false;
+    }
+    launch = task->launch;
+    begin = task->currentTask;
+    int count = 1;
+    if (launch->schedule.kind != SCHEDULE_AUTO) {
+        count = scheduleChunk(launch->schedule, task->endTask - begin, launch->totalTask, numSlots);
+    }
+    task->currentTask += count;
+    end = task->currentTask;
+    readyTasks.fetch_sub(count, std::memory_order_relaxed);
+    if (frontLane == PRIORITY_HIGH) {
+        readyUrgent.fetch_sub(count, std::memory_order_relaxed);
+    }
+    if (task->currentTask == task->endTask) {
+        popReady();
+    }
+    return true;
+}
+
+/*
+ * Runs tasks [begin, end) of `launch` with one runTaskRange() call
+ * under a fresh TaskScope, so run(), sync() and wait() called by the
+ * tasks see only the launches they make.  Launches the tasks left
+ * running are joined, helping, before the tasks count as finished.
+ */
+template <typename Lock>
+void BasicTaskSystemParallelThreadPoolSleeping<Lock>::runTasks(LaunchRecord* launch, int begin, int end) {
+    WorkerCounters* counters = localCounters();
+    if (counters != nullptr) {
+        counters->add(STAT_TASKS, end - begin);
+    }
+    TaskScope scope(this);
+    TaskScope* outer = tlsScope;
+    // tasks run while helping inside a task are part of that task's time
+    StatTimer busy(outer == nullptr ? counters : nullptr, STAT_BUSY_NS);
+    tlsScope = &scope;
+    launch->runner->runTaskRange(begin, end, launch->totalTask);
+    tlsScope = outer;
+    if (scope.pending.load(std::memory_order_acquire) > 0) {
+        helpUntil(tlsWorkerId, [&scope] { return scope.pending.load(std::memory_order_acquire) == 0; });
+    }
+    closeTaskEdges(launch);
+    if (!launch->taskSuccessors.empty()) {
+        releaseTaskSuccessors(launch, begin, end);
+    }
+}
+
+// runs one unit of ready work: a chunk claimed from the ready queue, or
+// a range on the work-stealing engine
+template <typename Lock>
+bool BasicTaskSystemParallelThreadPoolSleeping<Lock>::runOne(int workerId) {
+    if (workStealing) {
+        TaskRange range;
+        if (!findRange(workerId, range)) {
+            return false;
+        }
+        if (stats) {
+            workerStates[workerId].counters.add(STAT_CHUNKS);
+        }
+        setSearching(workerId, false);
+        if (lazySplit && range.launch->schedule.kind == SCHEDULE_AUTO) {
+            runRangeLazily(workerId, range);
+        } else {
+            runRange(workerId, range);
+        }
+        return true;
+    }
+    LaunchRecord* launch = nullptr;
+    int begin = 0, end = 0;
+    if (!claimReadyTask(launch, begin, end)) {
+        return false;
+    }
+    if (stats) {
+        workerStates[workerId].counters.add(STAT_CHUNKS);
+    }
+    setSearching(workerId, false);
+    runTasks(launch, begin, end);
+    finishTasks(launch, end - begin);
+    return true;
+}
+
+template <typename Lock>
+void BasicTaskSystemParallelThreadPoolSleeping<Lock>::workerFunc(int workerId) {
+    tlsPool = this;
+    tlsWorkerId = workerId;
+    int idleSpins = 0;
     while (!stop) {
-        ReadyTask task;
-        bool runTask = false;
-        mutexReadyQueue.lock();
-        if (!readyQueue.empty()) {
-            task = readyQueue.front();
-            if (task.currentTask < task.totalTask) {
-                runTask = true;
-                readyQueue.front().currentTask++;
-            } else {
-                readyQueue.pop();
+        long long pollStart = stats ? statNanos() : 0;
+        if (runOne(workerId)) {
+            spinHit(workerStates[workerId], idleSpins, maxSpin);
+            if (elastic) {
+                maybeGrow();
             }
         } else {
-            mutexWaitingQueue.lock();
-            while (!waitingQueue.empty()) {
-                auto& nextWaitingTask = waitingQueue.top();
-                if (nextWaitingTask.depTaskMaxId > finishedTask) break;
-                readyQueue.push(ReadyTask(nextWaitingTask.runner, nextWaitingTask.id, nextWaitingTask.totalTask));
-                isTaskDone.insert({nextWaitingTask.id, {0, nextWaitingTask.totalTask}});
-                waitingQueue.pop();
+            if (elastic && backlogSince.load(std::memory_order_relaxed) != 0) {
+                backlogSince.store(0, std::memory_order_relaxed);
+            }
+            setSearching(workerId, true);
+            if (!idle(workerId, idleSpins, pollStart)) {
+                retires.fetch_add(1, std::memory_order_relaxed);
+                std::lock_guard<Lock> lock(mutexElastic);
+                workerStates[workerId].attached = false;
+                break;
+            }
+        }
+    }
+    tlsPool = nullptr;
+}
+
+/*
+ * Work-stealing engine: a worker pops ranges from the bottom of its own
+ * deque, then picks up externally submitted launches from the ready queue,
+ * and finally steals from the top of a random victim's deque.  Ranges
+ * are split in halves before running, so the oldest (largest) halves
+ * are the ones left for thieves.  PRIORITY_HIGH launches in the ready
+ * queue go before the worker's own deque.
+ */
+template <typename Lock>
+bool BasicTaskSystemParallelThreadPoolSleeping<Lock>::findRange(int workerId, TaskRange& range) {
+    WorkerState& self = workerStates[workerId];
+    if (readyUrgent.load(std::memory_order_relaxed) > 0 && takeReady(range)) {
+        return true;
+    }
+    if (self.deque.take(range)) {
+        return true;
+    }
+    if (readyTasks.load(std::memory_order_relaxed) > 0 && takeReady(range)) {
+        return true;
+    }
+    for (int i = 0; i < numSlots; i++) {
+        // xorshift32
+        self.rngState ^= self.rngState << 13;
+        self.rngState ^= self.rngState >> 17;
+        self.rngState ^= self.rngState << 5;
+        int victim = self.rngState % (numSlots - 1);
+        if (victim >= workerId) victim++;
+        self.counters.add(STAT_STEAL_ATTEMPTS);
+        if (workerStates[victim].deque.steal(range)) {
+            self.counters.add(STAT_STEALS);
+            return true;
+        }
+    }
+    return false;
+}
+
+// takes the whole remaining range of the ready queue's next launch
+template <typename Lock>
+bool BasicTaskSystemParallelThreadPoolSleeping<Lock>::takeReady(TaskRange& range) {
+    CountedLockGuard<Lock> lock(mutexReadyQueue, localCounters());
+    ReadyTask* task = frontReady();
+    if (task == nullptr) {
+        return false;
+    }
+    range = {task->launch, task->currentTask, task->endTask};
+    readyTasks.fetch_sub(range.end - range.begin, std::memory_order_relaxed);
+    if (frontLane == PRIORITY_HIGH) {
+        readyUrgent.fetch_sub(range.end - range.begin, std::memory_order_relaxed);
+    }
+    popReady();
+    return true;
+}
+
+template <typename Lock>
+void BasicTaskSystemParallelThreadPoolSleeping<Lock>::runRange(int workerId, TaskRange range) {
+    LaunchRecord* launch = range.launch;
+    int grain = std::max(1, launch->totalTask / (4 * maxThread));
+    if (launch->schedule.kind != SCHEDULE_AUTO) {
+        // guided shrinks with the tasks of the launch still unfinished
+        grain = scheduleChunk(launch->schedule, launch->remainingTasks.load(std::memory_order_relaxed),
+                              launch->totalTask, numSlots);
+    }
+    while (range.end - range.begin > grain) {
+        int mid = range.begin + (range.end - range.begin) / 2;
+        TaskRange upper = range;
+        upper.begin = mid;
+        workerStates[workerId].deque.push(upper);
+        wakeWorkers(1);
+        range.end = mid;
+    }
+    runTasks(launch, range.begin, range.end);
+    finishTasks(launch, range.end - range.begin);
+}
+
+/*
+ * Lazy binary splitting (Tzannes et al., "Lazy Binary-Splitting: A
+ * Run-Time Adaptive Work-Stealing Scheduler"): the range runs as one
+ * piece, and between batches of tasks the worker checks whether some
+ * thread is polling for work while its own deque is empty.  Only then
+ * is the rest of the range halved and the upper half pushed for
+ * thieves, so a launch is split about as often as there are idle
+ * workers to take the halves, whatever its task count or task size.
+ * Parked workers do not count; each split wakes one, which then asks
+ * for work in turn.
+ *
+ * Batches start at one task and double while nobody is idle, so a range
+ * nobody asks for costs a logarithmic number of runTaskRange() calls.
+ */
+template <typename Lock>
+void BasicTaskSystemParallelThreadPoolSleeping<Lock>::runRangeLazily(int workerId, TaskRange range) {
+    LaunchRecord* launch = range.launch;
+    WorkerState& self = workerStates[workerId];
+    int i = range.begin;
+    int batch = 1;
+    while (i < range.end) {
+        if (range.end - i > 1 && numSearching.load(std::memory_order_relaxed) > 0 && self.deque.size() == 0) {
+            TaskRange upper = {launch, i + (range.end - i) / 2, range.end};
+            self.deque.push(upper);
+            self.splits.fetch_add(1, std::memory_order_relaxed);
+            wakeWorkers(1);
+            range.end = upper.begin;
+            batch = 1;
+        }
+        int next = i + std::min(batch, range.end - i);
+        runTasks(launch, i, next);
+        i = next;
+        batch = std::min(2 * batch, 1 << 20);
+    }
+    finishTasks(launch, range.end - range.begin);
+}
+
+/*
+ * Counters of the calling thread's slot: a worker's, or the last one
+ * for the thread inside sync().  Null when stats are off or the thread
+ * is not one of the pool's.
+ */
+template <typename Lock>
+WorkerCounters* BasicTaskSystemParallelThreadPoolSleeping<Lock>::localCounters() {
+    if (!stats || tlsPool != this) {
+        return nullptr;
+    }
+    return &workerStates[tlsWorkerId].counters;
+}
+
+template <typename Lock>
+TaskSystemStats BasicTaskSystemParallelThreadPoolSleeping<Lock>::getStats() {
+    TaskSystemStats snapshot;
+    if (!stats) {
+        return snapshot;
+    }
+    snapshot.enabled = true;
+    for (int i = 0; i < numSlots; i++) {
+        snapshot.workers.push_back(workerStates[i].counters.snapshot());
+    }
+    return snapshot;
+}
+
+template <typename Lock>
+void BasicTaskSystemParallelThreadPoolSleeping<Lock>::setSearching(int workerId, bool searching) {
+    WorkerState& self = workerStates[workerId];
+    if (self.searching != searching) {
+        self.searching = searching;
+        numSearching.fetch_add(searching ? 1 : -1, std::memory_order_relaxed);
+    }
+}
+
+/*
+ * Nested parallelism: a task may call run(), sync() and wait() on its
+ * own pool.  Instead of blocking its worker, the waiting thread keeps
+ * running ready tasks (help-first) and only sleeps on cvWake, where new
+ * work and the launches it waits for both wake it, when there is none.
+ */
+template <typename Lock>
+template <typename Done>
+void BasicTaskSystemParallelThreadPoolSleeping<Lock>::helpUntil(int workerId, const Done& done) {
+    int idleSpins = 0;
+    while (!done()) {
+        if (runOne(workerId)) {
+            idleSpins = 0;
+            if (elastic) {
+                maybeGrow();
             }
-            mutexWaitingQueue.unlock();
+            continue;
         }
-        mutexReadyQueue.unlock();
+        setSearching(workerId, true);
+        if (idleSpins < maxSpin) {
+            idleSpins++;
+            cpuRelax();
+        } else {
+            setSearching(workerId, false);
+            parkUntil(done);
+            idleSpins = 0;
+        }
+    }
+    // back to the waiting task, no longer available for split-off work
+    setSearching(workerId, false);
+}
 
-        if (runTask) {
-            task.runner->runTask(task.currentTask, task.totalTask);
-            // std::cerr << "worker run, cur task:" << task.currentTask << ", total:" << task.totalTask << std::endl;
-            mutexMap.lock();
-            auto& [finished, total] = isTaskDone[task.id];
-            finished++;
-            if (finished == total) {
-                isTaskDone.erase(task.id);
-                finishedTask = std::max(task.id, finishedTask);
+template <typename Lock>
+template <typename Done>
+void BasicTaskSystemParallelThreadPoolSleeping<Lock>::parkUntil(const Done& done) {
+    std::unique_lock<std::mutex> lock(mutexSleep);
+    numSleepers.fetch_add(1, std::memory_order_seq_cst);
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    if (!hasWork() && !done()) {
+        cvWake.wait(lock, [this, &done] { return wakeTokens > 0 || done(); });
+        if (wakeTokens > 0) {
+            if (done()) {
+                // leaving for our own task: hand the signal to another sleeper
+                cvWake.notify_one();
+            } else {
+                wakeTokens--;
             }
-            mutexMap.unlock();
         }
     }
+    numSleepers.fetch_sub(1, std::memory_order_relaxed);
+}
+
+template <typename Lock>
+void BasicTaskSystemParallelThreadPoolSleeping<Lock>::helpUntilLaunchDone(TaskID task) {
+    LaunchRecord* launch = launchTable.find(task);
+    launch->lock.lock();
+    bool live = launch->tag.load(std::memory_order_relaxed) == LaunchRecord::liveTag(task);
+    if (live) {
+        launch->helpers++;
+    }
+    launch->lock.unlock();
+    if (live) {
+        helpUntil(tlsWorkerId, [this, task] { return launchTable.isDone(task); });
+    }
+}
+
+static inline bool inTaskOf(ITaskSystem* pool) {
+    return tlsScope != nullptr && tlsScope->pool == pool;
 }
 
-void TaskSystemParallelThreadPoolSleeping::run(IRunnable* runnable, int num_total_tasks) {
-    runAsyncWithDeps(runnable, num_total_tasks, {});
+template <typename Lock>
+void BasicTaskSystemParallelThreadPoolSleeping<Lock>::run(IRunnable* runnable, int num_total_tasks, const Schedule& schedule) {
+    TaskID id = runAsyncWithDeps(runnable, num_total_tasks, {}, schedule);
+    if (inTaskOf(this)) {
+        helpUntilLaunchDone(id);
+        return;
+    }
     sync();
 }
 
-TaskID TaskSystemParallelThreadPoolSleeping::runAsyncWithDeps(IRunnable* runnable, int num_total_tasks, const std::vector<TaskID>& deps) {
-    TaskID dependancy = -1;
-    if (!deps.empty()) {
-        dependancy = *std::max(deps.begin(), deps.end());
+/*
+ * Registers the new launch as a successor of each of its unfinished
+ * dependencies.  The extra pendingDeps reference held during
+ * registration keeps a dependency that finishes concurrently from
+ * releasing the launch early.
+ */
+template <typename Lock>
+TaskID BasicTaskSystemParallelThreadPoolSleeping<Lock>::runAsyncWithDeps(IRunnable* runnable, int num_total_tasks,
+                                                              const std::vector<TaskID>& deps,
+                                                              const Schedule& schedule) {
+    std::unique_lock<Lock> priorityLock(mutexPriority, std::defer_lock);
+    LaunchRecord* launch = beginLaunch(runnable, num_total_tasks, schedule, priorityLock);
+    TaskID id = launch->id;
+
+    for (TaskID dep : deps) {
+        addDependency(launch, dep);
+    }
+    if (criticalPath) {
+        raiseBottomLevel(launch);
+        priorityLock.unlock();
+    }
+    if (launch->pendingDeps.fetch_sub(1, std::memory_order_acq_rel) == 1) {
+        makeReady(launch);
     }
-    WaitingTask task(runnable, nextTaskId, dependancy, num_total_tasks);
-    mutexWaitingQueue.lock();
-    waitingQueue.push(std::move(task));
-    mutexWaitingQueue.unlock();
-    return nextTaskId++;
+    return id;
 }
 
-void TaskSystemParallelThreadPoolSleeping::sync() {
+/*
+ * Opens a submission and returns the first free TaskID.  Under
+ * critical-path scheduling slots are only recycled while holding
+ * mutexPriority, so level propagation never races with it; the caller
+ * drops priorityLock once its dependencies are linked.  submitLock is
+ * held until endSubmit(): launches are published in id order even when
+ * several tasks submit at once, which the launch table relies on to
+ * grow.
+ */
+template <typename Lock>
+TaskID BasicTaskSystemParallelThreadPoolSleeping<Lock>::beginSubmit(std::unique_lock<Lock>& priorityLock) {
+    if (criticalPath) {
+        lockCounted(priorityLock, localCounters());
+    }
+    submitLock.lock();
+    return nextTaskId.load(std::memory_order_relaxed);
+}
+
+// publishes the live launches first .. first+n-1 and drops submitLock
+template <typename Lock>
+void BasicTaskSystemParallelThreadPoolSleeping<Lock>::endSubmit(TaskID first, int n, TaskScope* scope) {
+    nextTaskId.store(first + n, std::memory_order_release);
+    submitLock.unlock();
+    // none of them can finish before its submission reference is dropped
+    if (scope != nullptr) {
+        scope->pending.fetch_add(n, std::memory_order_relaxed);
+    }
+    unfinishedLaunches.fetch_add(n, std::memory_order_relaxed);
+}
+
+// submits one launch, still holding its submission reference
+template <typename Lock>
+LaunchRecord* BasicTaskSystemParallelThreadPoolSleeping<Lock>::beginLaunch(IRunnable* runnable, int num_total_tasks,
+                                                                const Schedule& schedule,
+                                                                std::unique_lock<Lock>& priorityLock) {
+    TaskScope* scope = inTaskOf(this) ? tlsScope : nullptr;
+    TaskID id = beginSubmit(priorityLock);
+    LaunchRecord* launch = launchTable.acquire(id);
+    initLaunch(launch, id, runnable, num_total_tasks, schedule, scope);
+    launch->tag.store(LaunchRecord::liveTag(id), std::memory_order_release);
+    endSubmit(id, 1, scope);
+    return launch;
+}
+
+// fills in a freshly acquired slot, holding one submission reference
+template <typename Lock>
+void BasicTaskSystemParallelThreadPoolSleeping<Lock>::initLaunch(LaunchRecord* launch, TaskID id, IRunnable* runnable,
+                                                      int num_total_tasks, const Schedule& schedule,
+                                                      TaskScope* scope) {
+    launch->runner = runnable;
+    launch->id = id;
+    launch->totalTask = num_total_tasks;
+    launch->schedule = schedule;
+    launch->remainingTasks.store(std::max(num_total_tasks, 1), std::memory_order_relaxed);
+    launch->pendingDeps.store(1, std::memory_order_relaxed);
+    launch->bottomLevel.store(std::max(num_total_tasks, 1), std::memory_order_relaxed);
+    launch->scope = scope;
+    launch->taskDeps.clear();
+    launch->perTask = false;
+    launch->taskEdgeState.store(0, std::memory_order_relaxed);
+    if (!launch->predecessors.empty()) {
+        // left behind by the slot's previous launch
+        predecessorPool.release(launch->predecessors);
+        launch->predecessors.clear();
+    }
+}
+
+/*
+ * Makes the live, not yet released `launch` wait for launch `dep` if
+ * that one is still unfinished.  Under critical-path scheduling the
+ * caller holds mutexPriority.
+ */
+template <typename Lock>
+void BasicTaskSystemParallelThreadPoolSleeping<Lock>::addDependency(LaunchRecord* launch, TaskID dep) {
+    if (dep < 0 || dep >= launch->id) {
+        return;
+    }
+    LaunchRecord* pred = launchTable.find(dep);
+    pred->lock.lock();
+    if (pred->tag.load(std::memory_order_relaxed) == LaunchRecord::liveTag(dep) &&
+        pred->remainingTasks.load(std::memory_order_acquire) > 0) {
+        pred->successors.push(edgePool.alloc(launch, launch->id));
+        launch->pendingDeps.fetch_add(1, std::memory_order_relaxed);
+        if (criticalPath) {
+            launch->predecessors.push(predecessorPool.alloc(pred, dep));
+        }
+    }
+    pred->lock.unlock();
+}
+
+/*
+ * Per-task dependencies: a launch with a DEP_IDENTITY or DEP_RANGE edge
+ * keeps a counter per task of the dependency's tasks it still waits
+ * for, plus one that is dropped when its launch-level dependencies are
+ * done.  Tasks whose counter reaches zero are handed out in runs of
+ * consecutive ids, as soon as the chunk that finished their last input
+ * returns from runTasks().
+ *
+ * An edge can only be per-task while no chunk of the dependency has
+ * finished.  taskEdgeState counts the edges being added, from the first
+ * look at the dependency until the dependent's counters are set; the
+ * first chunk to finish waits for it to drop to zero and closes it, so
+ * every chunk sees complete taskSuccessors lists and counters.  A
+ * dependency with a finished chunk gets a DEP_ALL edge instead.  Each
+ * per-task edge also holds one of the dependent launch's remainingTasks
+ * until the dependency retires, because finishing chunks of the
+ * dependency read the mapping stored in the dependent launch.
+ */
+template <typename Lock>
+TaskID BasicTaskSystemParallelThreadPoolSleeping<Lock>::runAsyncWithTaskDeps(IRunnable* runnable, int num_total_tasks,
+                                                                  const std::vector<TaskDep>& deps,
+                                                                  const Schedule& schedule) {
+    std::unique_lock<Lock> priorityLock(mutexPriority, std::defer_lock);
+    LaunchRecord* launch = beginLaunch(runnable, num_total_tasks, schedule, priorityLock);
+    TaskID id = launch->id;
+
+    for (const TaskDep& dep : deps) {
+        if (!addTaskDependency(launch, dep)) {
+            addDependency(launch, dep.id);
+        }
+    }
+    if (launch->perTask) {
+        initTaskPending(launch);
+        for (const TaskDep& dep : launch->taskDeps) {
+            launchTable.find(dep.id)->taskEdgeState.fetch_sub(1, std::memory_order_release);
+        }
+    }
+    if (criticalPath) {
+        raiseBottomLevel(launch);
+        priorityLock.unlock();
+    }
+    if (launch->pendingDeps.fetch_sub(1, std::memory_order_acq_rel) == 1) {
+        makeReady(launch);
+    }
+    return id;
+}
+
+/*
+ * Adds `dep` as a per-task edge.  Returns false if it has to be a
+ * launch-level edge instead.
+ */
+template <typename Lock>
+bool BasicTaskSystemParallelThreadPoolSleeping<Lock>::addTaskDependency(LaunchRecord* launch, const TaskDep& dep) {
+    if (dep.mapping == DEP_ALL || (dep.mapping == DEP_RANGE && !dep.range) || launch->totalTask == 0) {
+        return false;
+    }
+    if (dep.id < 0 || dep.id >= launch->id) {
+        return true;
+    }
+    LaunchRecord* pred = launchTable.find(dep.id);
+    bool added = true;
+    pred->lock.lock();
+    // an empty launch retires without running a chunk
+    if (pred->tag.load(std::memory_order_relaxed) == LaunchRecord::liveTag(dep.id) && pred->totalTask > 0) {
+        int state = pred->taskEdgeState.load(std::memory_order_relaxed);
+        while (state >= 0 && !pred->taskEdgeState.compare_exchange_weak(state, state + 1,
+                                                                        std::memory_order_acquire,
+                                                                        std::memory_order_relaxed)) {
+        }
+        if (state >= 0) {
+            pred->taskSuccessors.push(edgePool.alloc(launch, launch->id, (int)launch->taskDeps.size()));
+            if (launch->taskDeps.size() == launch->taskDeps.capacity()) {
+                taskBufferGrows.fetch_add(1, std::memory_order_relaxed);
+            }
+            launch->taskDeps.push_back(dep);
+            launch->remainingTasks.fetch_add(1, std::memory_order_relaxed);
+            launch->perTask = true;
+            if (criticalPath) {
+                launch->predecessors.push(predecessorPool.alloc(pred, dep.id));
+            }
+        } else {
+            added = false;
+        }
+    } else if (pred->tag.load(std::memory_order_relaxed) == LaunchRecord::liveTag(dep.id)) {
+        added = false;
+    }
+    pred->lock.unlock();
+    return added;
+}
+
+// called when a chunk of `launch` finished, before its successors are released
+template <typename Lock>
+void BasicTaskSystemParallelThreadPoolSleeping<Lock>::closeTaskEdges(LaunchRecord* launch) {
     while (true) {
-        std::lock_guard<std::mutex> lock(mutexMap);
-        if (finishedTask + 1 == nextTaskId) {
-            break;
+        int state = launch->taskEdgeState.load(std::memory_order_acquire);
+        if (state < 0) {
+            return;
+        }
+        int expected = 0;
+        if (state == 0 && launch->taskEdgeState.compare_exchange_weak(expected, -1, std::memory_order_acq_rel,
+                                                                      std::memory_order_acquire)) {
+            return;
+        }
+        cpuRelax();
+    }
+}
+
+// tasks [begin, end) of a launch of `upstream_tasks` tasks that `task` reads
+static inline void taskInputs(const TaskDep& dep, int task, int upstream_tasks, int& begin, int& end) {
+    if (dep.mapping == DEP_IDENTITY) {
+        begin = task;
+        end = task + 1;
+    } else {
+        dep.range(task, begin, end);
+    }
+    begin = std::max(begin, 0);
+    end = std::min(end, upstream_tasks);
+    if (end < begin) {
+        end = begin;
+    }
+}
+
+/*
+ * The dependencies in taskDeps cannot finish a chunk yet.  The counter
+ * array stays with the slot and is only regrown when a launch has more
+ * tasks than any earlier launch in the slot.
+ */
+template <typename Lock>
+void BasicTaskSystemParallelThreadPoolSleeping<Lock>::initTaskPending(LaunchRecord* launch) {
+    int n = launch->totalTask;
+    if (launch->taskPendingCapacity < n) {
+        launch->taskPending.reset(new std::atomic<int>[n]);
+        launch->taskPendingCapacity = n;
+        taskBufferGrows.fetch_add(1, std::memory_order_relaxed);
+    }
+    for (int i = 0; i < n; i++) {
+        launch->taskPending[i].store(1, std::memory_order_relaxed);
+    }
+    for (const TaskDep& dep : launch->taskDeps) {
+        int upstream = launchTable.find(dep.id)->totalTask;
+        for (int i = 0; i < n; i++) {
+            int begin, end;
+            taskInputs(dep, i, upstream, begin, end);
+            launch->taskPending[i].fetch_add(end - begin, std::memory_order_relaxed);
         }
     }
 }
+
+/*
+ * Tasks [begin, end) of `launch` finished: counts them off the tasks of
+ * its per-task successors that read them.  Input ranges are monotone,
+ * so the readers of a chunk are a contiguous run found by bisection.
+ */
+template <typename Lock>
+void BasicTaskSystemParallelThreadPoolSleeping<Lock>::releaseTaskSuccessors(LaunchRecord* launch, int begin, int end) {
+    int upstream = launch->totalTask;
+    for (EdgeNode* node = launch->taskSuccessors.first; node != nullptr; node = node->next) {
+        LaunchRecord* succ = node->launch;
+        const TaskDep& dep = succ->taskDeps[node->depIndex];
+        int first = 0, last = succ->totalTask;
+        if (dep.mapping == DEP_IDENTITY) {
+            first = std::min(begin, last);
+            last = std::min(end, last);
+        } else {
+            int lo = 0, hi = last;
+            while (lo < hi) {
+                int mid = lo + (hi - lo) / 2;
+                int b, e;
+                taskInputs(dep, mid, upstream, b, e);
+                if (e > begin) hi = mid; else lo = mid + 1;
+            }
+            first = lo;
+            hi = last;
+            while (lo < hi) {
+                int mid = lo + (hi - lo) / 2;
+                int b, e;
+                taskInputs(dep, mid, upstream, b, e);
+                if (b >= end) hi = mid; else lo = mid + 1;
+            }
+            last = lo;
+        }
+        releaseTasks(succ, first, last, [&dep, upstream, begin, end](int task) {
+            int b, e;
+            taskInputs(dep, task, upstream, b, e);
+            return std::max(0, std::min(e, end) - std::max(b, begin));
+        });
+    }
+}
+
+/*
+ * Takes count(i) off the counter of each task i in [begin, end) and
+ * hands out the tasks that reach zero, merging consecutive ones, with
+ * one wakeup for all of them.
+ */
+template <typename Lock>
+template <typename Count>
+void BasicTaskSystemParallelThreadPoolSleeping<Lock>::releaseTasks(LaunchRecord* launch, int begin, int end, const Count& count) {
+    int runBegin = begin, runEnd = begin;
+    int wake = 0;
+    for (int i = begin; i < end; i++) {
+        int c = count(i);
+        if (c == 0 || launch->taskPending[i].fetch_sub(c, std::memory_order_acq_rel) != c) {
+            continue;
+        }
+        if (runEnd != i) {
+            if (runEnd > runBegin) {
+                wake += queueRange(launch, runBegin, runEnd);
+            }
+            runBegin = i;
+        }
+        runEnd = i + 1;
+    }
+    if (runEnd > runBegin) {
+        wake += queueRange(launch, runBegin, runEnd);
+    }
+    wakeWorkers(wake);
+}
+
+/*
+ * Graph replay: the nodes take consecutive TaskIDs, node i getting
+ * first + i, and are filled in and wired up under a single hold of
+ * submitLock.  No other submitter can name the new ids before
+ * nextTaskId moves past them and none of the nodes can run before its
+ * submission reference is dropped, so the internal edges are pushed
+ * without taking record locks and every dependency count is set
+ * outright from the graph.  Bottom levels come precomputed with the
+ * graph; only sources with external dependencies are propagated.
+ */
+template <typename Lock>
+TaskID BasicTaskSystemParallelThreadPoolSleeping<Lock>::runGraph(const TaskGraph& graph, const std::vector<TaskID>& deps) {
+    int n = graph.size();
+    TaskScope* scope = inTaskOf(this) ? tlsScope : nullptr;
+    std::unique_lock<Lock> priorityLock(mutexPriority, std::defer_lock);
+    TaskID first = beginSubmit(priorityLock);
+    for (int i = 0; i < n; i++) {
+        const TaskGraphNode& node = graph.node(i);
+        TaskID id = first + i;
+        LaunchRecord* launch = launchTable.acquire(id);
+        initLaunch(launch, id, node.runner, node.numTasks, node.schedule, scope);
+        launch->pendingDeps.store(node.numDeps + 1, std::memory_order_relaxed);
+        launch->bottomLevel.store(node.bottomLevel, std::memory_order_relaxed);
+        launch->tag.store(LaunchRecord::liveTag(id), std::memory_order_release);
+    }
+    for (int i = 0; i < n; i++) {
+        const TaskGraphNode& node = graph.node(i);
+        LaunchRecord* launch = launchTable.find(first + i);
+        for (int k = 0; k < node.numSuccessors; k++) {
+            TaskID succId = first + graph.successors(i)[k];
+            LaunchRecord* succ = launchTable.find(succId);
+            launch->successors.push(edgePool.alloc(succ, succId));
+            if (criticalPath) {
+                succ->predecessors.push(predecessorPool.alloc(launch, first + i));
+            }
+        }
+    }
+    endSubmit(first, n, scope);
+
+    if (!deps.empty()) {
+        for (int source : graph.sources()) {
+            LaunchRecord* launch = launchTable.find(first + source);
+            for (TaskID dep : deps) {
+                addDependency(launch, dep);
+            }
+            if (criticalPath) {
+                raiseBottomLevel(launch);
+            }
+        }
+    }
+    if (criticalPath) {
+        priorityLock.unlock();
+    }
+    releaseBatch(first, n);
+    return first + n - 1;
+}
+
+/*
+ * Batch submission, like graph replay: the launches take consecutive
+ * TaskIDs and are filled in and linked to each other under one hold of
+ * submitLock.  Only dependencies on launches submitted before the batch
+ * go through addDependency() and its record locks.
+ */
+template <typename Lock>
+std::vector<TaskID> BasicTaskSystemParallelThreadPoolSleeping<Lock>::submitBatch(const std::vector<LaunchDesc>& launches) {
+    int n = (int)launches.size();
+    std::vector<TaskID> ids(n);
+    if (n == 0) {
+        return ids;
+    }
+    TaskScope* scope = inTaskOf(this) ? tlsScope : nullptr;
+    std::unique_lock<Lock> priorityLock(mutexPriority, std::defer_lock);
+    TaskID first = beginSubmit(priorityLock);
+    for (int i = 0; i < n; i++) {
+        const LaunchDesc& desc = launches[i];
+        TaskID id = first + i;
+        LaunchRecord* launch = launchTable.acquire(id);
+        initLaunch(launch, id, desc.runnable, desc.num_total_tasks, desc.schedule, scope);
+        for (int dep : desc.batch_deps) {
+            if (dep < 0 || dep >= i) {
+                continue;
+            }
+            LaunchRecord* pred = launchTable.find(first + dep);
+            pred->successors.push(edgePool.alloc(launch, id));
+            launch->pendingDeps.fetch_add(1, std::memory_order_relaxed);
+            if (criticalPath) {
+                launch->predecessors.push(predecessorPool.alloc(pred, first + dep));
+            }
+        }
+        launch->tag.store(LaunchRecord::liveTag(id), std::memory_order_release);
+        ids[i] = id;
+    }
+    endSubmit(first, n, scope);
+
+    for (int i = 0; i < n; i++) {
+        LaunchRecord* launch = launchTable.find(first + i);
+        for (TaskID dep : launches[i].deps) {
+            if (dep < first) {
+                addDependency(launch, dep);
+            }
+        }
+        if (criticalPath) {
+            raiseBottomLevel(launch);
+        }
+    }
+    if (criticalPath) {
+        priorityLock.unlock();
+    }
+    releaseBatch(first, n);
+    return ids;
+}
+
+/*
+ * Drops the submission reference of launches first .. first+n-1 and
+ * queues the ones with no dependency left, waking workers once for all
+ * of them.  A launch that is queued may finish and give its slot to a
+ * later submission at once, so every record is looked up before its
+ * reference is dropped and not touched after it was queued.
+ */
+template <typename Lock>
+void BasicTaskSystemParallelThreadPoolSleeping<Lock>::releaseBatch(TaskID first, int n) {
+    int wake = 0;
+    for (int i = 0; i < n; i++) {
+        LaunchRecord* launch = launchTable.find(first + i);
+        if (launch->pendingDeps.fetch_sub(1, std::memory_order_acq_rel) == 1) {
+            wake += queueLaunch(launch);
+        }
+    }
+    wakeWorkers(wake);
+}
+
+/*
+ * Critical-path scheduling: the bottom level of a launch is the task
+ * count of the longest path from it to the end of the graph submitted
+ * so far.  A new launch can only lengthen the paths through its
+ * unfinished predecessors, so its level is pushed up the predecessor
+ * lists until a launch's level no longer changes.  Launches that have
+ * retired, or whose slot was recycled, are skipped.  Predecessor lists
+ * and levels are only touched under mutexPriority, so the walk takes no
+ * record locks.
+ *
+ * New launches are propagated in batches of kLevelBatch, and before
+ * the submitter blocks in sync() or wait(), so an ancestor shared by
+ * many new launches is raised once per batch instead of once per
+ * launch.  Until then the heap orders by the levels known so far.
+ */
+static const int kLevelBatch = 32;
+
+// mutexPriority must be held
+template <typename Lock>
+void BasicTaskSystemParallelThreadPoolSleeping<Lock>::raiseBottomLevel(LaunchRecord* launch) {
+    LevelUpdate seed = {launch, launch->id, 0, true};
+    priorityStack.push_back(seed);
+    std::push_heap(priorityStack.begin(), priorityStack.end(), LevelUpdateOrder());
+    if (++pendingLevelSeeds >= kLevelBatch) {
+        propagateBottomLevels();
+    }
+}
+
+template <typename Lock>
+void BasicTaskSystemParallelThreadPoolSleeping<Lock>::flushBottomLevels() {
+    if (!criticalPath) {
+        return;
+    }
+    CountedLockGuard<Lock> guard(mutexPriority, localCounters());
+    if (pendingLevelSeeds > 0) {
+        propagateBottomLevels();
+    }
+}
+
+// mutexPriority must be held
+template <typename Lock>
+void BasicTaskSystemParallelThreadPoolSleeping<Lock>::propagateBottomLevels() {
+    bool raised = false;
+    size_t capacity = priorityStack.capacity();
+    while (!priorityStack.empty()) {
+        // dependencies have smaller ids than their dependents, so taking
+        // the largest id first sees every update of a launch at once and
+        // raises it a single time
+        std::pop_heap(priorityStack.begin(), priorityStack.end(), LevelUpdateOrder());
+        LevelUpdate update = priorityStack.back();
+        priorityStack.pop_back();
+        while (!priorityStack.empty() && priorityStack.front().id == update.id) {
+            update.successorLevel = std::max(update.successorLevel, priorityStack.front().successorLevel);
+            update.seed = update.seed || priorityStack.front().seed;
+            std::pop_heap(priorityStack.begin(), priorityStack.end(), LevelUpdateOrder());
+            priorityStack.pop_back();
+        }
+
+        LaunchRecord* rec = update.launch;
+        if (rec->tag.load(std::memory_order_acquire) == LaunchRecord::liveTag(update.id)) {
+            long long level = rec->bottomLevel.load(std::memory_order_relaxed);
+            long long candidate = std::max(rec->totalTask, 1) + update.successorLevel;
+            bool changed = candidate > level;
+            if (changed) {
+                level = candidate;
+                rec->bottomLevel.store(level, std::memory_order_relaxed);
+                raised = true;
+            }
+            // once a launch is ready all of its dependencies are done
+            if ((update.seed || changed) && rec->pendingDeps.load(std::memory_order_relaxed) > 0) {
+                for (EdgeNode* node = rec->predecessors.first; node != nullptr; node = node->next) {
+                    if (node->launch->tag.load(std::memory_order_relaxed) != LaunchRecord::liveTag(node->id)) {
+                        continue;
+                    }
+                    LevelUpdate next = {node->launch, node->id, level, false};
+                    priorityStack.push_back(next);
+                    std::push_heap(priorityStack.begin(), priorityStack.end(), LevelUpdateOrder());
+                }
+            }
+        }
+    }
+    pendingLevelSeeds = 0;
+    if (priorityStack.capacity() != capacity) {
+        priorityStackGrows++;
+    }
+    if (raised) {
+        readyOrderStale.store(true, std::memory_order_release);
+    }
+}
+
+/*
+ * Help mode of sync(): the calling thread works as an extra worker,
+ * using the spare worker slot, until the graph drains.  When it runs out
+ * of ready work it spins for maxSpin polls and then sleeps until the
+ * last launch signals `finished`.
+ *
+ * The slot's deque, searching flag and counters have a single owner, so
+ * only one outside thread helps at a time; others calling sync() or
+ * run() meanwhile just sleep until the graph drains.
+ */
+template <typename Lock>
+void BasicTaskSystemParallelThreadPoolSleeping<Lock>::helpUntilDone() {
+    if (helperSlotTaken.exchange(true, std::memory_order_acquire)) {
+        waitUntilDone();
+        return;
+    }
+    ITaskSystem* savedPool = tlsPool;
+    int savedWorkerId = tlsWorkerId;
+    tlsPool = this;
+    tlsWorkerId = maxThread;
+    WorkerCounters* counters = localCounters();
+    int idleSpins = 0;
+    while (unfinishedLaunches.load(std::memory_order_acquire) > 0) {
+        long long pollStart = counters != nullptr ? statNanos() : 0;
+        if (runOne(maxThread)) {
+            idleSpins = 0;
+        } else if (idleSpins < maxSpin) {
+            setSearching(maxThread, true);
+            idleSpins++;
+            cpuRelax();
+            if (counters != nullptr) {
+                counters->add(STAT_SPIN_NS, statNanos() - pollStart);
+            }
+        } else {
+            // blocked on the graph, not on work: nothing is split for it
+            setSearching(maxThread, false);
+            StatTimer parked(counters, STAT_PARKED_NS);
+            waitUntilDone();
+        }
+    }
+    setSearching(maxThread, false);
+    tlsPool = savedPool;
+    tlsWorkerId = savedWorkerId;
+    helperSlotTaken.store(false, std::memory_order_release);
+}
+
+template <typename Lock>
+void BasicTaskSystemParallelThreadPoolSleeping<Lock>::waitUntilDone() {
+    std::unique_lock<std::mutex> lock(mutexWait);
+    finished.wait(lock, [this] { return unfinishedLaunches.load(std::memory_order_acquire) == 0; });
+}
+
+template <typename Lock>
+void BasicTaskSystemParallelThreadPoolSleeping<Lock>::sync() {
+    flushBottomLevels();
+    if (inTaskOf(this)) {
+        // inside a task: wait for the launches this task made
+        TaskScope* scope = tlsScope;
+        helpUntil(tlsWorkerId, [scope] { return scope->pending.load(std::memory_order_acquire) == 0; });
+        return;
+    }
+    if (helpOnSync) {
+        helpUntilDone();
+    } else {
+        waitUntilDone();
+    }
+}
+
+// true if `task` names a launch some runXXX call returned
+template <typename Lock>
+bool BasicTaskSystemParallelThreadPoolSleeping<Lock>::issued(TaskID task) {
+    return task >= 0 && task < nextTaskId.load(std::memory_order_acquire);
+}
+
+/*
+ * A launch is done once the generation tag of its launchTable slot
+ * moved past it.  Waiters register on the record, so only launches
+ * somebody waits on notify launchFinished.
+ * Ids no runXXX call returned are never done, and wait() on one
+ * reports the misuse instead of blocking forever.
+ */
+template <typename Lock>
+bool BasicTaskSystemParallelThreadPoolSleeping<Lock>::isDone(TaskID task) {
+    if (!issued(task)) {
+        return false;
+    }
+    return launchTable.isDone(task);
+}
+
+template <typename Lock>
+void BasicTaskSystemParallelThreadPoolSleeping<Lock>::wait(TaskID task) {
+    if (!issued(task)) {
+        fprintf(stderr, "wait(): launch %d was never submitted\n", task);
+        return;
+    }
+    if (inTaskOf(this)) {
+        flushBottomLevels();
+        helpUntilLaunchDone(task);
+        return;
+    }
+    waitFor(task, std::chrono::microseconds::max());
+}
+
+template <typename Lock>
+bool BasicTaskSystemParallelThreadPoolSleeping<Lock>::waitFor(TaskID task, std::chrono::microseconds timeout) {
+    if (!issued(task)) {
+        return false;
+    }
+    flushBottomLevels();
+    LaunchRecord* launch = launchTable.find(task);
+    launch->lock.lock();
+    if (launch->tag.load(std::memory_order_relaxed) != LaunchRecord::liveTag(task)) {
+        launch->lock.unlock();
+        return true;
+    }
+    launch->waiters++;
+    launch->lock.unlock();
+
+    auto done = [this, task] { return launchTable.isDone(task); };
+    std::unique_lock<std::mutex> lock(mutexWait);
+    if (timeout == std::chrono::microseconds::max()) {
+        launchFinished.wait(lock, done);
+        return true;
+    }
+    if (launchFinished.wait_for(lock, timeout, done)) {
+        return true;
+    }
+    lock.unlock();
+    launch->lock.lock();
+    if (launch->tag.load(std::memory_order_relaxed) == LaunchRecord::liveTag(task)) {
+        launch->waiters--;
+    }
+    launch->lock.unlock();
+    return false;
+}
+
+template class BasicTaskSystemParallelThreadPoolSleeping<std::mutex>;
+template class BasicTaskSystemParallelThreadPoolSleeping<TtasLock>;
+template class BasicTaskSystemParallelThreadPoolSleeping<TicketLock>;
+template class BasicTaskSystemParallelThreadPoolSleeping<McsLock>;
+template class BasicTaskSystemParallelThreadPoolSleeping<FutexLock>;
@@ -2,11 +2,22 @@
 #define _TASKSYS_H
 
 #include "itasksys.h"
+#include "launchtable.h"
+#include "locks.h"
+#include "mpmcqueue.h"
+#include "ringqueue.h"
+#include "schedule.h"
+#include "taskgraph.h"
+#include "spinlock.h"
+#include "topology.h"
+#include "workerstats.h"
+#include "wsdeque.h"
+#include <atomic>
 #include <condition_variable>
 #include <iostream>
-#include <map>
+#include <memory>
 #include <mutex>
-#include <queue>
+#include <string>
 #include <thread>
 
 /*
@@ -19,9 +30,10 @@ class TaskSystemSerial: public ITaskSystem {
         TaskSystemSerial(int num_threads);
         ~TaskSystemSerial();
         const char* name();
-        void run(IRunnable* runnable, int num_total_tasks);
+        void run(IRunnable* runnable, int num_total_tasks, const Schedule& schedule = Schedule());
         TaskID runAsyncWithDeps(IRunnable* runnable, int num_total_tasks,
-                                const std::vector<TaskID>& deps);
+                                const std::vector<TaskID>& deps,
+                                const Schedule& schedule = Schedule());
         void sync();
 };
 
@@ -33,12 +45,13 @@ class TaskSystemSerial: public ITaskSystem {
  */
 class TaskSystemParallelSpawn: public ITaskSystem {
     public:
-        TaskSystemParallelSpawn(int num_threads);
+        TaskSystemParallelSpawn(int num_threads, const TaskSystemOptions& options = TaskSystemOptions());
         ~TaskSystemParallelSpawn();
         const char* name();
-        void run(IRunnable* runnable, int num_total_tasks);
+        void run(IRunnable* runnable, int num_total_tasks, const Schedule& schedule = Schedule());
         TaskID runAsyncWithDeps(IRunnable* runnable, int num_total_tasks,
-                                const std::vector<TaskID>& deps);
+                                const std::vector<TaskID>& deps,
+                                const Schedule& schedule = Schedule());
         void sync();
 };
 
@@ -50,12 +63,14 @@ class TaskSystemParallelSpawn: public ITaskSystem {
  */
 class TaskSystemParallelThreadPoolSpinning: public ITaskSystem {
     public:
-        TaskSystemParallelThreadPoolSpinning(int num_threads);
+        TaskSystemParallelThreadPoolSpinning(int num_threads,
+                                             const TaskSystemOptions& options = TaskSystemOptions());
         ~TaskSystemParallelThreadPoolSpinning();
         const char* name();
-        void run(IRunnable* runnable, int num_total_tasks);
+        void run(IRunnable* runnable, int num_total_tasks, const Schedule& schedule = Schedule());
         TaskID runAsyncWithDeps(IRunnable* runnable, int num_total_tasks,
-                                const std::vector<TaskID>& deps);
+                                const std::vector<TaskID>& deps,
+                                const Schedule& schedule = Schedule());
         void sync();
 };
 
@@ -65,54 +80,227 @@ class TaskSystemParallelThreadPoolSpinning: public ITaskSystem {
  * a thread pool. See definition of ITaskSystem in
  * itasksys.h for documentation of the ITaskSystem interface.
  */
-struct WaitingTask {
-    IRunnable* runner;
+struct ReadyTask {
+    LaunchRecord* launch;
+    int currentTask;    // next task id to hand out
+    int endTask;        // end of the ready range, the whole launch unless tasks are released one by one
+    long long level;    // bottom level of the launch, critical-path scheduling only
+    long long readySince;   // steady clock ns when queued, for priority aging
+    ReadyTask(LaunchRecord* _launch, int begin, int end): launch(_launch), currentTask(begin), endTask(end),
+                                                           level(0), readySince(0) {}
+    ReadyTask() {}
+};
+
+/*
+ * Heap order of the critical-path ready queue: longest remaining path
+ * first, ties go to the launch submitted first.
+ */
+struct ReadyTaskOrder {
+    bool operator()(const ReadyTask& a, const ReadyTask& b) const {
+        if (a.level != b.level) {
+            return a.level < b.level;
+        }
+        return a.launch->id > b.launch->id;
+    }
+};
+
+/*
+ * Launches submitted from inside one running task.  The scope lives on
+ * the stack of the thread running the task, which does not finish the
+ * task until `pending` drops to zero, so a launch never outlives the
+ * scope it points to.
+ */
+struct TaskScope {
+    ITaskSystem* pool;
+    std::atomic<int> pending;
+    TaskScope(ITaskSystem* _pool): pool(_pool), pending(0) {}
+};
+
+/*
+ * Pending bottom-level update: launch `id` in `launch` gained a
+ * successor whose bottom level is `successorLevel`.  A seed is a newly
+ * submitted launch whose own level still has to reach its dependencies.
+ */
+struct LevelUpdate {
+    LaunchRecord* launch;
     TaskID id;
-    TaskID depTaskMaxId;
-    int totalTask;
-    WaitingTask(IRunnable* _runner, TaskID _id, TaskID _depTaskMaxId, int _totalTask): runner(_runner), id(_id), depTaskMaxId(_depTaskMaxId), totalTask(_totalTask) {}
-    bool operator<(const WaitingTask& other) const {
-        return depTaskMaxId > other.depTaskMaxId;
+    long long successorLevel;
+    bool seed;
+};
+
+struct LevelUpdateOrder {
+    bool operator()(const LevelUpdate& a, const LevelUpdate& b) const {
+        return a.id < b.id;
     }
 };
 
-struct ReadyTask {
-    IRunnable* runner;
-    TaskID id;          // batch id
-    int currentTask;    // this task id
-    int totalTask;
-    ReadyTask(IRunnable* _runner, TaskID _id, int _totalTask): runner(_runner), id(_id), currentTask{0}, totalTask(_totalTask) {}
-    ReadyTask() {}
+/*
+ * Per-worker state.  The deque is only used by the work-stealing engine.
+ * The struct is padded so the counters of neighbouring workers do not
+ * share a cache line.  Steals and wakeups are always counted, for the
+ * verbose summary; the other counters only with options.stats.
+ */
+struct alignas(64) WorkerState {
+    RangeDeque deque;
+    WorkerCounters counters;
+    unsigned int rngState;
+    int spinBudget;             // idle polls before parking, adapted at runtime
+    std::atomic<long> parks;    // times the worker went to sleep
+    std::atomic<long> spinHits; // idle periods that ended with work while spinning
+    std::atomic<long> splits;   // ranges split for idle workers under lazy splitting
+    bool searching;             // counted in numSearching
+    bool attached;              // a worker thread runs in this slot, guarded by mutexElastic
+    WorkerState(): rngState(1), spinBudget(0), parks(0), spinHits(0), splits(0), searching(false),
+                   attached(false) {}
 };
 
-class TaskSystemParallelThreadPoolSleeping: public ITaskSystem {
+/*
+ * The sleeping pool, with the locks of its ready queues, its
+ * priority bookkeeping and its elastic slots of type Lock; see
+ * common/locks.h.  The locks the workers sleep on stay std::mutex,
+ * which std::condition_variable requires.  tasksys.cpp instantiates it
+ * for every lock there.
+ */
+template <typename Lock>
+class BasicTaskSystemParallelThreadPoolSleeping: public ITaskSystem {
     public:
-        TaskSystemParallelThreadPoolSleeping(int num_threads);
-        ~TaskSystemParallelThreadPoolSleeping();
+        BasicTaskSystemParallelThreadPoolSleeping(int num_threads,
+                                                  const TaskSystemOptions& options = TaskSystemOptions());
+        ~BasicTaskSystemParallelThreadPoolSleeping();
         const char* name();
-        void run(IRunnable* runnable, int num_total_tasks);
-        void workerFunc();
+        void run(IRunnable* runnable, int num_total_tasks, const Schedule& schedule = Schedule());
+        void workerFunc(int workerId);
         TaskID runAsyncWithDeps(IRunnable* runnable, int num_total_tasks,
-                                const std::vector<TaskID>& deps);
+                                const std::vector<TaskID>& deps,
+                                const Schedule& schedule = Schedule());
+        TaskID runAsyncWithTaskDeps(IRunnable* runnable, int num_total_tasks,
+                                    const std::vector<TaskDep>& deps,
+                                    const Schedule& schedule = Schedule());
+        TaskID runGraph(const TaskGraph& graph, const std::vector<TaskID>& deps = std::vector<TaskID>());
+        std::vector<TaskID> submitBatch(const std::vector<LaunchDesc>& launches);
         void sync();
+        void wait(TaskID task);
+        bool waitFor(TaskID task, std::chrono::microseconds timeout);
+        bool isDone(TaskID task);
+        TaskSystemStats getStats();
     private:
+        TaskID beginSubmit(std::unique_lock<Lock>& priorityLock);
+        void endSubmit(TaskID first, int n, TaskScope* scope);
+        LaunchRecord* beginLaunch(IRunnable* runnable, int num_total_tasks, const Schedule& schedule,
+                                  std::unique_lock<Lock>& priorityLock);
+        void initLaunch(LaunchRecord* launch, TaskID id, IRunnable* runnable, int num_total_tasks,
+                        const Schedule& schedule, TaskScope* scope);
+        void addDependency(LaunchRecord* launch, TaskID dep);
+        bool addTaskDependency(LaunchRecord* launch, const TaskDep& dep);
+        void initTaskPending(LaunchRecord* launch);
+        void makeReady(LaunchRecord* launch);
+        int queueLaunch(LaunchRecord* launch);
+        int queueRange(LaunchRecord* launch, int begin, int end);
+        void releaseBatch(TaskID first, int n);
+        template <typename Count> void releaseTasks(LaunchRecord* launch, int begin, int end, const Count& count);
+        void closeTaskEdges(LaunchRecord* launch);
+        void releaseTaskSuccessors(LaunchRecord* launch, int begin, int end);
+        void finishTasks(LaunchRecord* launch, int count);
+        void pushReady(ReadyTask task);
+        void drainSubmissions();
+        int pickLane();
+        ReadyTask* frontReady();
+        void popReady();
+        void raiseBottomLevel(LaunchRecord* launch);
+        void flushBottomLevels();
+        void propagateBottomLevels();
+        bool claimReadyTask(LaunchRecord*& launch, int& begin, int& end);
+        int readyChunks(LaunchRecord* launch, int count);
+        bool findRange(int workerId, TaskRange& range);
+        bool takeReady(TaskRange& range);
+        void runRange(int workerId, TaskRange range);
+        void runRangeLazily(int workerId, TaskRange range);
+        void setSearching(int workerId, bool searching);
+        bool hasWork();
+        WorkerCounters* localCounters();
+        bool issued(TaskID task);
+        bool idle(int workerId, int& idleSpins, long long pollStart);
+        bool park(int workerId);
+        void wakeWorkers(int count);
+        void startWorker(int workerId);
+        void noteBacklog();
+        void maybeGrow();
+        void runTasks(LaunchRecord* launch, int begin, int end);
+        bool runOne(int workerId);
+        template <typename Done> void helpUntil(int workerId, const Done& done);
+        template <typename Done> void parkUntil(const Done& done);
+        void helpUntilLaunchDone(TaskID task);
+        void helpUntilDone();
+        void waitUntilDone();
+
         int maxThread;
         std::vector<std::thread> workers;
         
-        std::map<TaskID, std::pair<int, int>> isTaskDone;   // task id -> {finished tasks, total}
-        TaskID finishedTask;    // if deptaskid <= finishedTask, blocked tasks are runnable
-        std::mutex mutexMap;
+        LaunchTable launchTable;
+        std::mutex mutexWait;
         std::condition_variable finished;   // wait/notify sync thread
+        std::condition_variable launchFinished;     // wait/notify threads in wait()/waitFor()
+        std::atomic<int> unfinishedLaunches;
 
-        std::priority_queue<WaitingTask, std::vector<WaitingTask>> waitingQueue;
-        std::mutex mutexWaitingQueue;
-
-        std::queue<ReadyTask> readyQueue;
-        std::mutex mutexReadyQueue;
+        // one lane per priority class of launches whose tasks are handed
+        // out; the injection queue of the work-stealing engine
+        RingQueue<ReadyTask> readyQueues[NUM_PRIORITIES];
+        std::vector<ReadyTask> readyHeaps[NUM_PRIORITIES];  // replace readyQueues under critical-path scheduling
+        int frontLane;                      // lane of the last frontReady() result
+        long long agingNs;                  // wait that lifts a ready launch by one class, 0 for strict classes
+        std::atomic<int> readyUrgent;       // unclaimed tasks in the PRIORITY_HIGH lane
+        long readyHeapGrows;
+        std::atomic<bool> readyOrderStale;  // a queued launch's bottom level was raised since the heap was built
+        Lock mutexReadyQueue;
+        std::atomic<int> readyTasks;        // unclaimed tasks in readyQueues and submitQueue, checked before locking
+        MpmcQueue<ReadyTask> submitQueue;   // launches made ready, not yet moved into their lane
+        std::atomic<long> submitOverflows;  // pushes that found submitQueue full and took the lock
+        std::atomic<long> taskBufferGrows;  // regrown taskDeps and taskPending buffers of recycled slots
         
-        TaskID nextTaskId;
+        std::atomic<TaskID> nextTaskId;
+        SpinLock submitLock;                // serializes id assignment and slot acquisition; tasks submit too
+        EdgePool edgePool;
+        Lock mutexPriority;                             // guards bottom levels, predecessor lists and slot reuse
+        EdgePool predecessorPool;                       // only used under mutexPriority, kept apart from the workers' pool
+        std::vector<LevelUpdate> priorityStack;         // max-heap on id, guarded by mutexPriority
+        long priorityStackGrows;
+        int pendingLevelSeeds;                          // new launches not yet propagated, guarded by mutexPriority
+
+        bool workStealing;
+        bool verbose;
+        bool stats;
+        int maxSpin;
+        bool helpOnSync;
+        std::atomic<bool> helperSlotTaken;  // a thread inside sync() owns the spare worker slot
+        bool criticalPath;
+        bool lazySplit;
+        int numSlots;   // maxThread workers plus one slot for the thread inside sync()
+        std::unique_ptr<WorkerState[]> workerStates;
 
-        bool stop;  // stop worker threads
+        std::mutex mutexSleep;
+        std::condition_variable cvWake;
+        std::atomic<int> numSleepers;   // parked workers, including ones already signalled
+        std::atomic<int> numSearching;  // threads polling for work
+        int wakeTokens;                 // signals not yet consumed, guarded by mutexSleep
+        std::atomic<long> wakeSignals;
+
+        // elastic pool: workers run in slots 0 .. maxThread-1, which
+        // threads attach to when spawned and leave when retired
+        bool elastic;
+        int minThread;
+        long long growDelayNs;
+        std::chrono::microseconds idleTimeout;
+        std::vector<int> placement;         // cpu of each worker slot, empty if unpinned
+        Lock mutexElastic;                  // guards workers and the slots' attached flags
+        std::atomic<int> numWorkers;        // workers not retiring
+        std::atomic<long long> backlogSince;    // steady clock ns since ready work found no parked worker, 0 if it did
+        std::atomic<long> spawns;           // workers added after construction
+        std::atomic<long> retires;
+
+        std::atomic<bool> stop;  // stop worker threads
+        std::string displayName;
 };
 
+typedef BasicTaskSystemParallelThreadPoolSleeping<std::mutex> TaskSystemParallelThreadPoolSleeping;
+
 #endif
@@ -0,0 +1,146 @@
+#ifndef _WSDEQUE_H
+#define _WSDEQUE_H
+
+#include <atomic>
+#include <cstdint>
+#include <vector>
+
+struct LaunchRecord;
+
+/*
+ * TaskRange: a contiguous slice [begin, end) of the task indices of
+ * one bulk task launch.
+ */
+struct TaskRange {
+    LaunchRecord* launch;
+    int begin;
+    int end;
+};
+
+/*
+ * RangeDeque: Chase-Lev work-stealing deque of TaskRanges (Le et al.,
+ * "Correct and Efficient Work-Stealing for Weak Memory Models").
+ *
+ * push() and take() may only be called by the owning worker and operate
+ * on the bottom of the deque; steal() may be called by any thread and
+ * takes from the top.  The ring buffer grows on demand; retired buffers
+ * are kept until the deque is destroyed since a thief may still be
+ * reading from them.
+ */
+class RangeDeque {
+    public:
+        RangeDeque(int log_capacity = 8): top(0), bottom(0) {
+            buffer.store(new Buffer(log_capacity), std::memory_order_relaxed);
+        }
+        ~RangeDeque() {
+            delete buffer.load(std::memory_order_relaxed);
+            for (Buffer* b : retired) {
+                delete b;
+            }
+        }
+
+        void push(const TaskRange& range) {
+            int64_t b = bottom.load(std::memory_order_relaxed);
+            int64_t t = top.load(std::memory_order_acquire);
+            Buffer* buf = buffer.load(std::memory_order_relaxed);
+            if (b - t > buf->mask) {
+                buf = grow(buf, t, b);
+            }
+            buf->put(b, range);
+            bottom.store(b + 1, std::memory_order_release);
+        }
+
+        bool take(TaskRange& range) {
+            int64_t b = bottom.load(std::memory_order_relaxed) - 1;
+            Buffer* buf = buffer.load(std::memory_order_relaxed);
+            bottom.store(b, std::memory_order_relaxed);
+            std::atomic_thread_fence(std::memory_order_seq_cst);
+            int64_t t = top.load(std::memory_order_relaxed);
+            if (t > b) {
+                bottom.store(b + 1, std::memory_order_relaxed);
+                return false;
+            }
+            range = buf->get(b);
+            if (t == b) {
+                // last element: race against thieves for it
+                bool won = top.compare_exchange_strong(t, t + 1, std::memory_order_seq_cst,
+                                                       std::memory_order_relaxed);
+                bottom.store(b + 1, std::memory_order_relaxed);
+                return won;
+            }
+            return true;
+        }
+
+        bool steal(TaskRange& range) {
+            int64_t t = top.load(std::memory_order_acquire);
+            std::atomic_thread_fence(std::memory_order_seq_cst);
+            int64_t b = bottom.load(std::memory_order_acquire);
+            if (t >= b) {
+                return false;
+            }
+            Buffer* buf = buffer.load(std::memory_order_acquire);
+            range = buf->get(t);
+            return top.compare_exchange_strong(t, t + 1, std::memory_order_seq_cst,
+                                               std::memory_order_relaxed);
+        }
+
+        // approximate number of queued ranges, used for load balancing only
+        int64_t size() const {
+            int64_t b = bottom.load(std::memory_order_relaxed);
+            int64_t t = top.load(std::memory_order_relaxed);
+            return b > t ? b - t : 0;
+        }
+
+        // times the ring buffer had to be reallocated, owner only
+        long growCount() const { return retired.size(); }
+
+    private:
+        // slot fields are atomics so that a thief racing with the owner
+        // reads a stale value instead of invoking a data race
+        struct Slot {
+            std::atomic<LaunchRecord*> launch;
+            std::atomic<int> begin, end;
+        };
+
+        struct Buffer {
+            int64_t mask;
+            Slot* slots;
+            Buffer(int log_capacity): mask((int64_t(1) << log_capacity) - 1) {
+                slots = new Slot[mask + 1];
+            }
+            ~Buffer() { delete[] slots; }
+            void put(int64_t i, const TaskRange& r) {
+                Slot& s = slots[i & mask];
+                s.launch.store(r.launch, std::memory_order_relaxed);
+                s.begin.store(r.begin, std::memory_order_relaxed);
+                s.end.store(r.end, std::memory_order_relaxed);
+            }
+            TaskRange get(int64_t i) const {
+                const Slot& s = slots[i & mask];
+                TaskRange r;
+                r.launch = s.launch.load(std::memory_order_relaxed);
+                r.begin = s.begin.load(std::memory_order_relaxed);
+                r.end = s.end.load(std::memory_order_relaxed);
+                return r;
+            }
+        };
+
+        Buffer* grow(Buffer* old, int64_t t, int64_t b) {
+            int log_capacity = 0;
+            while ((int64_t(1) << log_capacity) <= old->mask) log_capacity++;
+            Buffer* bigger = new Buffer(log_capacity + 1);
+            for (int64_t i = t; i < b; i++) {
+                bigger->put(i, old->get(i));
+            }
+            retired.push_back(old);
+            buffer.store(bigger, std::memory_order_release);
+            return bigger;
+        }
+
+        alignas(64) std::atomic<int64_t> top;
+        alignas(64) std::atomic<int64_t> bottom;
+        std::atomic<Buffer*> buffer;
+        std::vector<Buffer*> retired;   // owner only
+};
+
+#endif
@@ -0,0 +1,143 @@
+#ifndef _LOCKBENCH_H
+#define _LOCKBENCH_H
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <stdio.h>
+#include <thread>
+#include <vector>
+
+#include "locks.h"
+#include "parallel.h"
+#include "topology.h"
+
+/*
+ * Lock contention microbenchmark, run by runtasks -k.  Threads acquire
+ * one lock in a loop for a fixed time.  Every critical section updates
+ * a shared cache line, and between acquisitions every thread does some
+ * private work, so the lock is contended but not held all the time.
+ * Reports the acquisitions per second, and how evenly they were spread
+ * over the threads as Jain's fairness index (1 when every thread got the
+ * same share, 1/threads when one thread got them all) and as the ratio
+ * of the fewest to the most acquisitions of a thread.
+ */
+
+struct LockBenchResult {
+    double mopsPerSec;
+    double jain;
+    double minMax;
+    bool passed;    // the shared counters add up, so no two threads were inside at once
+};
+
+const int kLockBenchCritical = 16;  // shared updates per acquisition
+const int kLockBenchPrivate = 64;   // dependent multiply-adds between acquisitions
+
+template <typename Lock>
+LockBenchResult benchLock(int num_threads, const std::vector<int>& placement, double seconds) {
+    Lock lock;
+    long shared[8] = {0};
+    PaddedPartials<long> acquisitions(num_threads, 0);
+    std::atomic<bool> go(false), stop(false);
+    std::atomic<unsigned> sink(0);
+
+    std::vector<std::thread> threads;
+    for (int i = 0; i < num_threads; i++) {
+        threads.push_back(std::thread([&, i]() {
+            spinUntil([&go]() { return go.load(std::memory_order_acquire); });
+            long count = 0;
+            unsigned x = 2 * i + 1;
+            while (!stop.load(std::memory_order_relaxed)) {
+                lock.lock();
+                for (int k = 0; k < kLockBenchCritical; k++) {
+                    shared[k & 7]++;
+                }
+                lock.unlock();
+                count++;
+                for (int k = 0; k < kLockBenchPrivate; k++) {
+                    x = x * 1664525u + 1013904223u;
+                }
+            }
+            acquisitions[i] = count;
+            sink += x;
+        }));
+    }
+    pinWorkers(threads, placement);
+
+    auto start = std::chrono::steady_clock::now();
+    go.store(true, std::memory_order_release);
+    std::this_thread::sleep_for(std::chrono::duration<double>(seconds));
+    stop = true;
+    double elapsed = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    for (auto& t : threads) {
+        t.join();
+    }
+
+    long total = 0, least = acquisitions[0], most = acquisitions[0];
+    double squares = 0;
+    for (int i = 0; i < num_threads; i++) {
+        long n = acquisitions[i];
+        total += n;
+        least = std::min(least, n);
+        most = std::max(most, n);
+        squares += (double)n * n;
+    }
+    long updates = 0;
+    for (int k = 0; k < 8; k++) {
+        updates += shared[k];
+    }
+
+    LockBenchResult result;
+    result.mopsPerSec = total / elapsed / 1e6;
+    result.jain = squares > 0 ? (double)total * total / (num_threads * squares) : 0;
+    result.minMax = most > 0 ? (double)least / most : 0;
+    result.passed = updates == total * kLockBenchCritical;
+    return result;
+}
+
+inline LockBenchResult benchLockKind(LockKind kind, int num_threads, const std::vector<int>& placement,
+                                     double seconds) {
+    switch (kind) {
+    case LOCK_TTAS:
+        return benchLock<TtasLock>(num_threads, placement, seconds);
+    case LOCK_TICKET:
+        return benchLock<TicketLock>(num_threads, placement, seconds);
+    case LOCK_MCS:
+        return benchLock<McsLock>(num_threads, placement, seconds);
+    case LOCK_FUTEX:
+        return benchLock<FutexLock>(num_threads, placement, seconds);
+    default:
+        return benchLock<std::mutex>(num_threads, placement, seconds);
+    }
+}
+
+/*
+ * Times every lock under 1, 2, 4, ... and `max_threads` contending
+ * threads placed as `options` asks.  Returns false if a lock let two
+ * threads in at once.
+ */
+inline bool lockContentionBenchmark(int max_threads, const TaskSystemOptions& options, double seconds = 0.1) {
+    max_threads = resolveThreadCount(max_threads);
+    std::vector<int> counts;
+    for (int n = 1; n < max_threads; n *= 2) {
+        counts.push_back(n);
+    }
+    counts.push_back(max_threads);
+
+    printf("Lock contention, %.0f ms per run, %d shared updates per acquisition:\n",
+           seconds * 1000, kLockBenchCritical);
+    printf("%-8s %8s %12s %10s %10s\n", "lock", "threads", "Mops/s", "Jain", "min/max");
+    bool passed = true;
+    for (int kind = 0; kind < NUM_LOCK_KINDS; kind++) {
+        for (int n : counts) {
+            std::vector<int> placement = CpuTopology::get().placement(options.pin_policy, n, options.pin_cpus);
+            LockBenchResult r = benchLockKind((LockKind)kind, n, placement, seconds);
+            printf("%-8s %8d %12.3f %10.3f %10.3f%s\n", lockKindName((LockKind)kind), n,
+                   r.mopsPerSec, r.jain, r.minMax, r.passed ? "" : "  ERROR: lost updates");
+            passed = passed && r.passed;
+        }
+    }
+    return passed;
+}
+
+#endif
@@ -2,10 +2,12 @@
 #include <stdio.h>
 #include <getopt.h>
 #include <string>
+#include <string.h>
 #include <assert.h>
 
 #include "tasksys.h"
 #include "tests.h"
+#include "lockbench.h"
 
 #define DEFAULT_NUM_THREADS 8
 #define DEFAULT_NUM_TIMING_ITERATIONS 3
@@ -14,8 +16,20 @@
 void usage(const char* progname, std::string *testnames, int num_tests) {
     printf("Usage: %s [options] testname\n", progname);
     printf("Program Options:\n");
-    printf("  -n  --num_threads  <INT>      Number of threads: <INT> (default=%d)\n", DEFAULT_NUM_THREADS);
+    printf("  -n  --num_threads  <INT>      Number of threads: <INT> (default=%d, 0 sizes pools from the CPU topology)\n", DEFAULT_NUM_THREADS);
     printf("  -i  --num_timing_iterations <INT> Number of timing iterations: <INT> (default=%d)\n", DEFAULT_NUM_TIMING_ITERATIONS);
+    printf("  -w  --work_stealing           Use per-worker work-stealing deques in the sleeping thread pool\n");
+    printf("  -s  --max_spin <INT>          Idle polls before a pool worker parks: <INT> (default=%d)\n", TaskSystemOptions().max_spin);
+    printf("  -l  --lazy_split              Work-stealing pool that splits launches only for idle workers (implies -w)\n");
+    printf("  -b  --block_on_sync           sync() sleeps until the graph drains instead of running tasks\n");
+    printf("  -v  --verbose                 Print scheduler counters after each run\n");
+    printf("  -a  --affinity <POLICY>       Pin pool workers: none, compact, scatter or a cpu list such as 0,2,4-7 (default=none)\n");
+    printf("  -e  --elastic <INT>           Elastic sleeping pool keeping <INT> workers when idle, up to -n under load\n");
+    printf("  -p  --critical_path           Also time the sleeping thread pool with critical-path priority scheduling\n");
+    printf("  -m  --schedule_matrix         Also time each parallel task system under every launch schedule\n");
+    printf("  -x  --lock <LOCK>             Lock of the sleeping pool's queues: mutex, ttas, ticket, mcs or futex (default=mutex)\n");
+    printf("  -k  --lock_bench              Time every lock under 1 to -n contending threads instead of running a test\n");
+    printf("  -c  --stats                   Print the per-worker runtime counters of each task system after each test\n");
     printf("  -?  --help                    This message\n");
     printf("Valid testnames are:");
     for(int i = 0; i < num_tests; i++) {
@@ -31,27 +45,153 @@ enum TaskSystemType {
     N_TASKSYS_IMPLS, // This must be in the last position.
 };
 
-ITaskSystem *selectTaskSystemRefImpl(int num_threads, TaskSystemType type) {
+ITaskSystem *selectSleepingImpl(int num_threads, const TaskSystemOptions& options, LockKind lock) {
+    switch (lock) {
+    case LOCK_TTAS:
+        return new BasicTaskSystemParallelThreadPoolSleeping<TtasLock>(num_threads, options);
+    case LOCK_TICKET:
+        return new BasicTaskSystemParallelThreadPoolSleeping<TicketLock>(num_threads, options);
+    case LOCK_MCS:
+        return new BasicTaskSystemParallelThreadPoolSleeping<McsLock>(num_threads, options);
+    case LOCK_FUTEX:
+        return new BasicTaskSystemParallelThreadPoolSleeping<FutexLock>(num_threads, options);
+    default:
+        return new TaskSystemParallelThreadPoolSleeping(num_threads, options);
+    }
+}
+
+ITaskSystem *selectTaskSystemRefImpl(int num_threads, TaskSystemType type,
+                                     const TaskSystemOptions& options, LockKind lock = LOCK_MUTEX) {
     assert(type < N_TASKSYS_IMPLS);
 
     if (type == SERIAL) {
         return new TaskSystemSerial(num_threads);
     } else if (type == PARALLEL_SPAWN) {
-        return new TaskSystemParallelSpawn(num_threads);
+        return new TaskSystemParallelSpawn(num_threads, options);
     } else if (type == PARALLEL_THREAD_POOL_SPINNING) {
-        return new TaskSystemParallelThreadPoolSpinning(num_threads);
+        return new TaskSystemParallelThreadPoolSpinning(num_threads, options);
     } else if (type == PARALLEL_THREAD_POOL_SLEEPING) {
-        return new TaskSystemParallelThreadPoolSleeping(num_threads);
+        return selectSleepingImpl(num_threads, options, lock);
     } else {
         return NULL;
     }
 }
 
+/*
+ * Gives every launch of a test `schedule`, unless the test picked a
+ * schedule for the launch itself.
+ */
+class ScheduledTaskSystem: public ITaskSystem {
+    public:
+        ScheduledTaskSystem(ITaskSystem* inner, const Schedule& schedule)
+            : ITaskSystem(0), inner_(inner), schedule_(schedule) {}
+        ~ScheduledTaskSystem() { delete inner_; }
+        const char* name() { return inner_->name(); }
+        void run(IRunnable* runnable, int num_total_tasks, const Schedule& schedule = Schedule()) {
+            inner_->run(runnable, num_total_tasks, pick(schedule));
+        }
+        TaskID runAsyncWithDeps(IRunnable* runnable, int num_total_tasks, const std::vector<TaskID>& deps,
+                                const Schedule& schedule = Schedule()) {
+            return inner_->runAsyncWithDeps(runnable, num_total_tasks, deps, pick(schedule));
+        }
+        TaskID runAsyncWithTaskDeps(IRunnable* runnable, int num_total_tasks, const std::vector<TaskDep>& deps,
+                                    const Schedule& schedule = Schedule()) {
+            return inner_->runAsyncWithTaskDeps(runnable, num_total_tasks, deps, pick(schedule));
+        }
+        std::vector<TaskID> submitBatch(const std::vector<LaunchDesc>& launches) {
+            std::vector<LaunchDesc> picked(launches);
+            for (LaunchDesc& desc : picked) {
+                desc.schedule = pick(desc.schedule);
+            }
+            return inner_->submitBatch(picked);
+        }
+        // re-records the graph only when there is a schedule to hand out
+        TaskID runGraph(const TaskGraph& graph, const std::vector<TaskID>& deps = std::vector<TaskID>()) {
+            if (schedule_.kind == SCHEDULE_AUTO) {
+                return inner_->runGraph(graph, deps);
+            }
+            TaskGraphRecorder recorder;
+            for (int i = 0; i < graph.size(); i++) {
+                const TaskGraphNode& node = graph.node(i);
+                std::vector<TaskID> node_deps(graph.deps(i), graph.deps(i) + node.numDeps);
+                recorder.runAsyncWithDeps(node.runner, node.numTasks, node_deps, pick(node.schedule));
+            }
+            return inner_->runGraph(recorder.finish(), deps);
+        }
+        void sync() { inner_->sync(); }
+        void wait(TaskID task) { inner_->wait(task); }
+        bool waitFor(TaskID task, std::chrono::microseconds timeout) { return inner_->waitFor(task, timeout); }
+        bool isDone(TaskID task) { return inner_->isDone(task); }
+        TaskSystemStats getStats() { return inner_->getStats(); }
+
+    private:
+        Schedule pick(const Schedule& schedule) const {
+            if (schedule.kind != SCHEDULE_AUTO) {
+                return schedule;
+            }
+            Schedule picked = schedule_;
+            picked.priority = schedule.priority;
+            return picked;
+        }
+
+        ITaskSystem* inner_;
+        Schedule schedule_;
+};
+
+/*
+ * Prints the counters of ITaskSystem::getStats(), one row per worker
+ * slot and the sum, times in ms.  Prints nothing for task systems that
+ * keep no counters.
+ */
+void printStats(const TaskSystemStats& stats) {
+    if (!stats.enabled) {
+        return;
+    }
+    printf("  %-8s %10s %8s %8s %8s %8s %10s %10s %10s %10s\n", "worker", "tasks", "chunks", "steals", "tries",
+           "wakeups", "busy ms", "spin ms", "parked ms", "lock ms");
+    auto row = [](const char* label, const WorkerStats& w) {
+        printf("  %-8s %10lld %8lld %8lld %8lld %8lld %10.3f %10.3f %10.3f %10.3f\n", label,
+               w[STAT_TASKS], w[STAT_CHUNKS], w[STAT_STEALS], w[STAT_STEAL_ATTEMPTS], w[STAT_WAKEUPS],
+               w[STAT_BUSY_NS] / 1e6, w[STAT_SPIN_NS] / 1e6, w[STAT_PARKED_NS] / 1e6, w[STAT_LOCK_WAIT_NS] / 1e6);
+    };
+    for (size_t i = 0; i < stats.workers.size(); i++) {
+        char label[16];
+        snprintf(label, sizeof(label), "%d", (int)i);
+        row(label, stats.workers[i]);
+    }
+    row("total", stats.total());
+}
+
+/*
+ * Fastest of `num_timing_iterations` runs of `test` with every launch
+ * under `schedule`.  Exits if a run fails its correctness check.
+ */
+double timeScheduled(TestResults (*test)(ITaskSystem*), int num_threads, TaskSystemType type,
+                     const TaskSystemOptions& options, LockKind lock, const Schedule& schedule,
+                     int num_timing_iterations) {
+    double minT = 1e30;
+    for (int j = 0; j < num_timing_iterations; j++) {
+        ScheduledTaskSystem t(selectTaskSystemRefImpl(num_threads, type, options, lock), schedule);
+        TestResults result = test(&t);
+        if (!result.passed) {
+            printf("ERROR: Results did not pass correctness check! (iter=%d, ref_impl=%s, schedule=%d,%d)\n",
+                j, t.name(), (int)schedule.kind, schedule.chunk);
+            exit(1);
+        }
+        minT = std::min(minT, result.time);
+    }
+    return minT;
+}
+
 int main(int argc, char** argv)
 {
-    const int n_tests = 31;
+    const int n_tests = 45;
     int num_threads = DEFAULT_NUM_THREADS;
     int num_timing_iterations = DEFAULT_NUM_TIMING_ITERATIONS;
+    TaskSystemOptions options;
+    bool schedule_matrix = false;
+    LockKind lock = LOCK_MUTEX;
+    bool lock_bench = false;
 
     TestResults (*test[n_tests])(ITaskSystem*) = {
         simpleTestSync,
@@ -60,29 +200,45 @@ int main(int argc, char** argv)
         pingPongUnequalTest,
         superLightTest,
         superSuperLightTest,
+        superLightLambdaTest,
         recursiveFibonacciTest,
+        recursiveFibonacciNestedTest,
         mathOperationsInTightForLoopTest,
         mathOperationsInTightForLoopFewerTasksTest,
         mathOperationsInTightForLoopFanInTest,
         mathOperationsInTightForLoopReductionTreeTest,
+        mathOperationsInTightForLoopFanInReduceTest,
+        mathOperationsInTightForLoopReductionTreeReduceTest,
         spinBetweenRunCallsTest,
         mandelbrotChunkedTest,
         pingPongEqualAsyncTest,
         pingPongUnequalAsyncTest,
+        pingPongUnequalPipelinedAsyncTest,
+        stencilAsyncTest,
+        stencilPipelinedAsyncTest,
         superLightAsyncTest,
         superSuperLightAsyncTest,
+        superLightLambdaAsyncTest,
         recursiveFibonacciAsyncTest,
+        recursiveFibonacciNestedAsyncTest,
         mathOperationsInTightForLoopAsyncTest,
+        mathOperationsInTightForLoopGraphTest,
         mathOperationsInTightForLoopFewerTasksAsyncTest,
         mathOperationsInTightForLoopFanInAsyncTest,
         mathOperationsInTightForLoopReductionTreeAsyncTest,
         mandelbrotChunkedAsyncTest,
         spinBetweenRunCallsAsyncTest,
         simpleRunDepsTest,
+        waitOnLaunchTest,
+        highPriorityLatencyTest,
+        normalPriorityLatencyTest,
+        multiProducerSubmitTest,
+        concurrentRunTest,
         strictDiamondDepsTest,
         strictGraphDepsSmall,
         strictGraphDepsMedium,
         strictGraphDepsLarge,
+        strictGraphDepsLargeBatch,
     };
 
     std::string test_names[n_tests] = {
@@ -92,29 +248,45 @@ int main(int argc, char** argv)
         "ping_pong_unequal",
         "super_light",
         "super_super_light",
+        "super_light_lambda",
         "recursive_fibonacci",
+        "recursive_fibonacci_nested",
         "math_operations_in_tight_for_loop",
         "math_operations_in_tight_for_loop_fewer_tasks",
         "math_operations_in_tight_for_loop_fan_in",
         "math_operations_in_tight_for_loop_reduction_tree",
+        "math_operations_in_tight_for_loop_fan_in_reduce",
+        "math_operations_in_tight_for_loop_reduction_tree_reduce",
         "spin_between_run_calls",
         "mandelbrot_chunked",
         "ping_pong_equal_async",
         "ping_pong_unequal_async",
+        "ping_pong_unequal_pipelined_async",
+        "stencil_async",
+        "stencil_pipelined_async",
         "super_light_async",
         "super_super_light_async",
+        "super_light_lambda_async",
         "recursive_fibonacci_async",
+        "recursive_fibonacci_nested_async",
         "math_operations_in_tight_for_loop_async",
+        "math_operations_in_tight_for_loop_graph_async",
         "math_operations_in_tight_for_loop_fewer_tasks_async",
         "math_operations_in_tight_for_loop_fan_in_async",
         "math_operations_in_tight_for_loop_reduction_tree_async",
         "mandelbrot_chunked_async",
         "spin_between_run_calls_async",
         "simple_run_deps_test",
+        "wait_on_launch_async",
+        "high_priority_latency_async",
+        "normal_priority_latency_async",
+        "multi_producer_submit_async",
+        "concurrent_run_async",
         "strict_diamond_deps_async",
         "strict_graph_deps_small_async",
         "strict_graph_deps_med_async",
         "strict_graph_deps_large_async",
+        "strict_graph_deps_large_batch_async",
     };
  
     // Parse commandline options
@@ -122,10 +294,23 @@ int main(int argc, char** argv)
     static struct option long_options[] = {
         {"num_threads",           1, 0,  'n'},
         {"num_timing_iterations", 1, 0,  'i'},
+        {"work_stealing",         0, 0,  'w'},
+        {"max_spin",              1, 0,  's'},
+        {"lazy_split",            0, 0,  'l'},
+        {"block_on_sync",         0, 0,  'b'},
+        {"verbose",               0, 0,  'v'},
+        {"critical_path",         0, 0,  'p'},
+        {"elastic",               1, 0,  'e'},
+        {"affinity",              1, 0,  'a'},
+        {"schedule_matrix",       0, 0,  'm'},
+        {"lock",                  1, 0,  'x'},
+        {"lock_bench",            0, 0,  'k'},
+        {"stats",                 0, 0,  'c'},
         {"help",                  0, 0,  '?'},
+        {0,                       0, 0,  0},
     };
 
-    while ((opt = getopt_long(argc, argv, "n:i:?", long_options, NULL)) != EOF) {
+    while ((opt = getopt_long(argc, argv, "n:i:wls:bvpe:a:mx:kc?", long_options, NULL)) != EOF) {
 
         switch (opt) {
         case 'n':
@@ -134,6 +319,59 @@ int main(int argc, char** argv)
         case 'i':
             num_timing_iterations = atoi(optarg);
             break;
+        case 'w':
+            options.work_stealing = true;
+            break;
+        case 's':
+            options.max_spin = atoi(optarg);
+            break;
+        case 'l':
+            options.lazy_split = true;
+            break;
+        case 'b':
+            options.help_on_sync = false;
+            break;
+        case 'v':
+            options.verbose = true;
+            break;
+        case 'p':
+            options.critical_path = true;
+            break;
+        case 'e':
+            options.elastic = true;
+            options.min_threads = atoi(optarg);
+            break;
+        case 'a':
+            if (strcmp(optarg, "none") == 0) {
+                options.pin_policy = PIN_NONE;
+            } else if (strcmp(optarg, "compact") == 0) {
+                options.pin_policy = PIN_COMPACT;
+            } else if (strcmp(optarg, "scatter") == 0) {
+                options.pin_policy = PIN_SCATTER;
+            } else {
+                options.pin_policy = PIN_EXPLICIT;
+                options.pin_cpus = parseCpuList(optarg);
+                if (options.pin_cpus.empty()) {
+                    usage(argv[0], test_names, n_tests);
+                    return 1;
+                }
+            }
+            break;
+        case 'm':
+            schedule_matrix = true;
+            break;
+        case 'x':
+            if (!parseLockKind(optarg, lock)) {
+                usage(argv[0], test_names, n_tests);
+                return 1;
+            }
+            break;
+        case 'k':
+            lock_bench = true;
+            break;
+        case 'c':
+            options.stats = true;
+            break;
         case '?':
         default:
             usage(argv[0], test_names, n_tests);
@@ -141,6 +379,10 @@ int main(int argc, char** argv)
         }
     }
 
+    if (lock_bench) {
+        return lockContentionBenchmark(num_threads, options) ? 0 : 1;
+    }
+
     if (optind + 1 > argc) {
         fprintf(stderr, "Error: missing test_name!\n");
         usage(argv[0], test_names, n_tests);
@@ -149,6 +391,10 @@ int main(int argc, char** argv)
 
     std::string test_name = argv[optind];
 
+    if (options.verbose) {
+        CpuTopology::get().print();
+    }
+
     bool found = false;
     for (int test_id = 0; test_id < n_tests; test_id++) {
         if (test_names[test_id].compare(test_name) != 0) {
@@ -162,12 +408,19 @@ int main(int argc, char** argv)
         printf("============================================================="
                "======================\n");
 
-        for (int i = 0; i < N_TASKSYS_IMPLS; i++) {
+        // with -p the sleeping pool runs twice, FIFO first and then with
+        // critical-path priority, so the two makespans can be compared
+        int num_runs = N_TASKSYS_IMPLS + (options.critical_path ? 1 : 0);
+        for (int i = 0; i < num_runs; i++) {
+            TaskSystemType type = (TaskSystemType) std::min(i, (int) PARALLEL_THREAD_POOL_SLEEPING);
+            TaskSystemOptions run_options = options;
+            run_options.critical_path = options.critical_path && i == N_TASKSYS_IMPLS;
+
             double minT = 1e30;
             for (int j = 0; j < num_timing_iterations; j++) {
 
                 // Create a new task system
-                ITaskSystem *t = selectTaskSystemRefImpl(num_threads, (TaskSystemType) i);
+                ITaskSystem *t = selectTaskSystemRefImpl(num_threads, type, run_options, lock);
 
                 // Run test
                 TestResults result = test[test_id](t);
@@ -184,12 +437,45 @@ int main(int argc, char** argv)
                 // TODO: do this better
                 if( j+1 == num_timing_iterations) {
                     printf("[%s]:\t\t[%.3f] ms\n", t->name(), minT * 1000);
+                    printStats(t->getStats());
                 }
 
                 // Shutdown task system so each timing run is from a clean start
                 delete t;
             }
         }
+
+        // with -m every parallel task system is timed once per schedule,
+        // the test's own launches forced onto it, and the fastest named
+        if (schedule_matrix) {
+            const int n_schedules = 5;
+            const char* schedule_names[n_schedules] = {"auto", "static", "dynamic", "dynamic,8", "guided"};
+            Schedule schedules[n_schedules] = {
+                Schedule(),
+                Schedule(SCHEDULE_STATIC),
+                Schedule(SCHEDULE_DYNAMIC),
+                Schedule(SCHEDULE_DYNAMIC, 8),
+                Schedule(SCHEDULE_GUIDED),
+            };
+            printf("Schedules, min of %d iterations in ms:\n", num_timing_iterations);
+            for (int type = PARALLEL_SPAWN; type < N_TASKSYS_IMPLS; type++) {
+                ITaskSystem* named = selectTaskSystemRefImpl(num_threads, (TaskSystemType) type, options, lock);
+                printf("[%s]:\t", named->name());
+                delete named;
+                int best = 0;
+                double bestT = 1e30;
+                for (int k = 0; k < n_schedules; k++) {
+                    double minT = timeScheduled(test[test_id], num_threads, (TaskSystemType) type, options, lock,
+                                                schedules[k], num_timing_iterations);
+                    printf(" %s %.3f", schedule_names[k], minT * 1000);
+                    if (minT < bestT) {
+                        bestT = minT;
+                        best = k;
+                    }
+                }
+                printf("  -> %s\n", schedule_names[best]);
+            }
+        }
         printf("============================================================="
                "======================\n");
     }
@@ -9,6 +9,8 @@
 
 #include "CycleTimer.h"
 #include "itasksys.h"
+#include "parallel.h"
+#include "taskgraph.h"
 
 /*
 Sync tests
@@ -17,10 +19,14 @@ TestResults pingPongEqualTest(ITaskSystem *t);
 TestResults pingPongUnequalTest(ITaskSystem *t);
 TestResults superLightTest(ITaskSystem *t);
 TestResults superSuperLightTest(ITaskSystem *t);
+TestResults superLightLambdaTest(ITaskSystem *t);
 TestResults recursiveFibonacciTest(ITaskSystem* t);
+TestResults recursiveFibonacciNestedTest(ITaskSystem* t);
 TestResults mathOperationsInTightForLoopTest(ITaskSystem* t);
 TestResults mathOperationsInTightForLoopFanInTest(ITaskSystem* t);
 TestResults mathOperationsInTightForLoopReductionTreeTest(ITaskSystem* t);
+TestResults mathOperationsInTightForLoopFanInReduceTest(ITaskSystem* t);
+TestResults mathOperationsInTightForLoopReductionTreeReduceTest(ITaskSystem* t);
 TestResults spinBetweenRunCallsTest(ITaskSystem *t);
 TestResults mandelbrotChunkedTest(ITaskSystem* t);
 
@@ -28,15 +34,26 @@ Async with dependencies tests
 =============================
 TestResults pingPongEqualAsyncTest(ITaskSystem *t);
 TestResults pingPongUnequalAsyncTest(ITaskSystem *t);
+TestResults pingPongUnequalPipelinedAsyncTest(ITaskSystem *t);
+TestResults stencilAsyncTest(ITaskSystem *t);
+TestResults stencilPipelinedAsyncTest(ITaskSystem *t);
 TestResults superLightAsyncTest(ITaskSystem *t);
 TestResults superSuperLightAsyncTest(ITaskSystem *t);
+TestResults superLightLambdaAsyncTest(ITaskSystem *t);
 TestResults recursiveFibonacciAsyncTest(ITaskSystem* t);
+TestResults recursiveFibonacciNestedAsyncTest(ITaskSystem* t);
 TestResults mathOperationsInTightForLoopAsyncTest(ITaskSystem* t);
+TestResults mathOperationsInTightForLoopGraphTest(ITaskSystem* t);
 TestResults mathOperationsInTightForLoopFanInAsyncTest(ITaskSystem* t);
 TestResults mathOperationsInTightForLoopReductionTreeAsyncTest(ITaskSystem* t);
 TestResults spinBetweenRunCallsAsyncTest(ITaskSystem *t);
 TestResults mandelbrotChunkedAsyncTest(ITaskSystem* t);
 TestResults simpleRunDepsTest(ITaskSystem *t);
+TestResults waitOnLaunchTest(ITaskSystem *t);
+TestResults highPriorityLatencyTest(ITaskSystem *t);
+TestResults normalPriorityLatencyTest(ITaskSystem *t);
+TestResults multiProducerSubmitTest(ITaskSystem *t);
+TestResults concurrentRunTest(ITaskSystem *t);
 */
 
 /*
@@ -141,10 +158,15 @@ class SimpleMultiplyTask : public IRunnable {
         }
 
         void runTask(int task_id, int num_total_tasks) {
+            runTaskRange(task_id, task_id + 1, num_total_tasks);
+        }
+
+        // tasks own consecutive slices, so a range of tasks is one slice
+        void runTaskRange(int begin, int end, int num_total_tasks) {
             // handle case where num_elements is not evenly divisible by num_total_tasks
             int elements_per_task = (num_elements_ + num_total_tasks-1) / num_total_tasks;
-            int start_el = elements_per_task * task_id;
-            int end_el = std::min(start_el + elements_per_task, num_elements_);
+            int start_el = std::min(elements_per_task * begin, num_elements_);
+            int end_el = std::min(elements_per_task * end, num_elements_);
 
             for (int i=start_el; i<end_el; i++)
                 array_[i] = multiply_task(3, array_[i]);
@@ -187,11 +209,16 @@ class PingPongTask : public IRunnable {
         }
 
         void runTask(int task_id, int num_total_tasks) {
+            runTaskRange(task_id, task_id + 1, num_total_tasks);
+        }
+
+        // tasks own consecutive slices, so a range of tasks is one slice
+        void runTaskRange(int begin, int end, int num_total_tasks) {
 
             // handle case where num_elements is not evenly divisible by num_total_tasks
             int elements_per_task = (num_elements_ + num_total_tasks-1) / num_total_tasks;
-            int start_el = elements_per_task * task_id;
-            int end_el = std::min(start_el + elements_per_task, num_elements_);
+            int start_el = std::min(elements_per_task * begin, num_elements_);
+            int end_el = std::min(elements_per_task * end, num_elements_);
 
             if (equal_work_) {
                 for (int i=start_el; i<end_el; i++)
@@ -205,6 +232,44 @@ class PingPongTask : public IRunnable {
         }
 };
 
+/*
+ * Each task averages each element of its slice of the input with its two
+ * neighbours and writes the result to the output.  Elements take up to
+ * twice `iters_` steps of extra work, the most at the left end of the
+ * buffer if `heavy_left_` and at the right end otherwise.
+ */
+class StencilTask : public IRunnable {
+    public:
+        int num_elements_;
+        int* input_array_;
+        int* output_array_;
+        int iters_;
+        bool heavy_left_;
+
+        StencilTask(int num_elements, int* input_array, int* output_array, int iters, bool heavy_left)
+            : num_elements_(num_elements), input_array_(input_array),
+              output_array_(output_array), iters_(iters), heavy_left_(heavy_left) {}
+
+        void runTask(int task_id, int num_total_tasks) {
+            runTaskRange(task_id, task_id + 1, num_total_tasks);
+        }
+
+        void runTaskRange(int begin, int end, int num_total_tasks) {
+            int elements_per_task = (num_elements_ + num_total_tasks-1) / num_total_tasks;
+            int start_el = std::min(elements_per_task * begin, num_elements_);
+            int end_el = std::min(elements_per_task * end, num_elements_);
+
+            for (int i=start_el; i<end_el; i++) {
+                int left = input_array_[std::max(i - 1, 0)];
+                int right = input_array_[std::min(i + 1, num_elements_ - 1)];
+                int pos = heavy_left_ ? i : num_elements_ - 1 - i;
+                int iters = PingPongTask::ping_pong_iters(pos, num_elements_, iters_);
+                int value = PingPongTask::ping_pong_work(iters, left + input_array_[i] + right);
+                output_array_[i] = value % 1000;
+            }
+        }
+};
+
 /*
  * Each task computes and writes the idx-th fibonacci number into the
  * position output[task_id].
@@ -225,6 +290,54 @@ class RecursiveFibonacciTask: public IRunnable {
         void runTask(int task_id, int num_total_tasks) {
             output_[task_id] = slowFn(idx_);
         }
+
+        void runTaskRange(int begin, int end, int num_total_tasks) {
+            for (int i = begin; i < end; i++) {
+                output_[i] = slowFn(idx_);
+            }
+        }
+};
+
+/*
+ * Nested launches: computes the idx-th fibonacci number with one launch
+ * of two tasks, where task k computes fib(idx-1-k) into output[k] by
+ * launching its own two-task NestedFibonacciTask on the same task
+ * system, and waiting for it, from inside runTask.  Below `cutoff` the
+ * recursion runs serially.
+ */
+class NestedFibonacciTask: public IRunnable {
+    public:
+        ITaskSystem* t_;
+        int idx_;
+        int cutoff_;
+        bool do_async_;
+        int *output_;
+        NestedFibonacciTask(ITaskSystem* t, int idx, int cutoff, bool do_async, int *output)
+            : t_(t), idx_(idx), cutoff_(cutoff), do_async_(do_async), output_(output) {}
+        ~NestedFibonacciTask() {}
+
+        int slowFn(int n) {
+            if (n < 2) return 1;
+            return slowFn(n-1) + slowFn(n-2);
+        }
+
+        void runTask(int task_id, int num_total_tasks) {
+            int n = idx_ - 1 - task_id;
+            if (n < cutoff_) {
+                output_[task_id] = slowFn(n);
+                return;
+            }
+            int sub[2] = {0, 0};
+            NestedFibonacciTask child(t_, n, cutoff_, do_async_, sub);
+            if (do_async_) {
+                std::vector<TaskID> deps;
+                t_->runAsyncWithDeps(&child, 2, deps);
+                t_->sync();
+            } else {
+                t_->run(&child, 2);
+            }
+            output_[task_id] = sub[0] + sub[1];
+        }
 };
 
 /*
@@ -239,6 +352,12 @@ class LightTask: public IRunnable {
         void runTask(int task_id, int num_total_tasks) {
             output_[task_id] = task_id;
         }
+
+        void runTaskRange(int begin, int end, int num_total_tasks) {
+            for (int i = begin; i < end; i++) {
+                output_[i] = i;
+            }
+        }
 };
 
 /*
@@ -256,9 +375,14 @@ class MathOperationsInTightForLoopTask: public IRunnable {
         ~MathOperationsInTightForLoopTask() {}
 
         void runTask(int task_id, int num_total_tasks) {
+            runTaskRange(task_id, task_id + 1, num_total_tasks);
+        }
+
+        // tasks own consecutive slices, the last one taking the remainder
+        void runTaskRange(int begin_task, int end_task, int num_total_tasks) {
             int elements_per_task = array_size_ / num_total_tasks;
-            int start = task_id * elements_per_task;
-            int end = std::min(start + elements_per_task, array_size_);
+            int start = begin_task * elements_per_task;
+            int end = std::min(end_task * elements_per_task, array_size_);
             if (array_size_ - end < elements_per_task) {
                 end = array_size_;
             }
@@ -413,6 +537,19 @@ class MandelbrotTask: public IRunnable {
                                  args_->max_iterations, args_->output);
             }
         }
+
+        // contiguous chunks of consecutive tasks are adjacent rows
+        void runTaskRange(int begin, int end, int num_total_tasks) {
+            if (interleave_ == 1) {
+                IRunnable::runTaskRange(begin, end, num_total_tasks);
+                return;
+            }
+            int rowsPerTask = args_->height / num_total_tasks;
+            mandelbrotSerial(args_->x0, args_->y0, args_->x1, args_->y1,
+                             args_->width, args_->height,
+                             begin * rowsPerTask, (end - begin) * rowsPerTask,
+                             args_->max_iterations, args_->output);
+        }
 };
 
 /*
@@ -582,10 +719,12 @@ TestResults simpleTestAsync(ITaskSystem* t) {
  * launching threads is non-trival and so there are benefits to a thread pool.
  * The amount of computation per task is controlled using `num_elements` and
  * `base_iters`, because each task gets `num_elements` / `num_tasks` elements
- * and does O(base_iters) work per element.
+ * and does O(base_iters) work per element.  With `per_task_deps`, task i
+ * of each launch only waits for task i of the launch before it, since
+ * that is the only task that wrote its input.
  */
 TestResults pingPongTest(ITaskSystem* t, bool equal_work, bool do_async,
-                         int num_elements, int base_iters) {
+                         int num_elements, int base_iters, bool per_task_deps = false) {
 
     int num_tasks = 64;
     int num_bulk_task_launches = 400;   
@@ -618,7 +757,14 @@ TestResults pingPongTest(ITaskSystem* t, bool equal_work, bool do_async,
     double start_time = CycleTimer::currentSeconds();
     TaskID prev_task_id;
     for (int i=0; i<num_bulk_task_launches; i++) {
-        if (do_async) {
+        if (do_async && per_task_deps) {
+            std::vector<TaskDep> deps;
+            if (i > 0) {
+                deps.push_back(TaskDep(prev_task_id, DEP_IDENTITY));
+            }
+            prev_task_id = t->runAsyncWithTaskDeps(
+                runnables[i], num_tasks, deps);
+        } else if (do_async) {
             std::vector<TaskID> deps;
             if (i > 0) {
                 deps.push_back(prev_task_id);
@@ -713,6 +859,180 @@ TestResults pingPongUnequalAsyncTest(ITaskSystem* t) {
     return pingPongTest(t, false, true, num_elements, base_iters);
 }
 
+TestResults pingPongUnequalPipelinedAsyncTest(ITaskSystem* t) {
+    int num_elements = 512 * 1024;
+    int base_iters = 32;
+    return pingPongTest(t, false, true, num_elements, base_iters, true);
+}
+
+/*
+ * Computation: stencilTest chains 100 launches of StencilTask, 64 tasks
+ * each, ping-ponging between two buffers of 32K elements.  Every element
+ * reads its neighbours, so task i reads the slices of tasks i-1 to i+1
+ * of the launch before it.  With `per_task_deps` the launches depend on
+ * each other through that range mapping instead of as a whole, and
+ * alternate between more work on the left and on the right, so later
+ * launches can start on one side while the other is still running.
+ */
+TestResults stencilTest(ITaskSystem* t, bool per_task_deps) {
+    int num_tasks = 64;
+    int num_bulk_task_launches = 100;
+    int num_elements = 32 * 1024;
+    int base_iters = 32;
+
+    int* input = new int[num_elements];
+    int* output = new int[num_elements];
+    int* expected = new int[num_elements];
+    int* scratch = new int[num_elements];
+    for (int i=0; i<num_elements; i++) {
+        input[i] = i % 1000;
+        expected[i] = i % 1000;
+    }
+
+    std::vector<StencilTask> runnables;
+    for (int i=0; i<num_bulk_task_launches; i++) {
+        if (i % 2 == 0)
+            runnables.push_back(StencilTask(num_elements, input, output, base_iters, i % 4 == 0));
+        else
+            runnables.push_back(StencilTask(num_elements, output, input, base_iters, i % 4 == 0));
+    }
+
+    // task i reads its own slice and one element of each neighbour
+    std::function<void(int, int&, int&)> neighbours = [](int task, int& begin, int& end) {
+        begin = task - 1;
+        end = task + 2;
+    };
+
+    double start_time = CycleTimer::currentSeconds();
+    TaskID prev_task_id = -1;
+    for (int i=0; i<num_bulk_task_launches; i++) {
+        std::vector<TaskDep> deps;
+        if (i > 0) {
+            if (per_task_deps) {
+                deps.push_back(TaskDep(prev_task_id, neighbours));
+            } else {
+                deps.push_back(TaskDep(prev_task_id));
+            }
+        }
+        prev_task_id = t->runAsyncWithTaskDeps(&runnables[i], num_tasks, deps);
+    }
+    t->sync();
+    double end_time = CycleTimer::currentSeconds();
+
+    for (int i=0; i<num_bulk_task_launches; i++) {
+        StencilTask reference(num_elements, expected, scratch, base_iters, i % 4 == 0);
+        reference.runTaskRange(0, 1, 1);
+        std::swap(expected, scratch);
+    }
+
+    TestResults results;
+    results.passed = true;
+    int* buffer = (num_bulk_task_launches % 2 == 1) ? output : input;
+    for (int i=0; i<num_elements; i++) {
+        if (buffer[i] != expected[i]) {
+            results.passed = false;
+            printf("%d: %d expected=%d\n", i, buffer[i], expected[i]);
+            break;
+        }
+    }
+    results.time = end_time - start_time;
+
+    delete [] input;
+    delete [] output;
+    delete [] expected;
+    delete [] scratch;
+
+    return results;
+}
+
+TestResults stencilAsyncTest(ITaskSystem* t) {
+    return stencilTest(t, false);
+}
+
+TestResults stencilPipelinedAsyncTest(ITaskSystem* t) {
+    return stencilTest(t, true);
+}
+
+/*
+ * Computation: superLightLambdaTest is superLightTest written against
+ * parallel_for() and launchAsync(): 400 back-to-back launches over a
+ * buffer of 32K elements, one task per element, each task body a lambda.
+ * Comparing it against super_light shows what the per-call-site task
+ * body costs or saves over a hand-written IRunnable that owns 64 slices.
+ */
+TestResults superLightLambdaTest(ITaskSystem* t, bool do_async) {
+    int num_elements = 32 * 1024;
+    int base_iters = 32;
+    int num_bulk_task_launches = 400;
+
+    int* input = new int[num_elements];
+    int* output = new int[num_elements];
+    for (int i=0; i<num_elements; i++) {
+        input[i] = i;
+        output[i] = 0;
+    }
+
+    // Run the test
+    double start_time = CycleTimer::currentSeconds();
+    if (do_async) {
+        std::vector<AsyncLaunch> launches(num_bulk_task_launches);
+        for (int i=0; i<num_bulk_task_launches; i++) {
+            int* in = (i % 2 == 0) ? input : output;
+            int* out = (i % 2 == 0) ? output : input;
+            std::vector<TaskID> deps;
+            if (i > 0) {
+                deps.push_back(launches[i-1].id());
+            }
+            launches[i] = launchAsync(*t, num_elements, [=](int el) {
+                out[el] = PingPongTask::ping_pong_work(base_iters, in[el]);
+            }, deps);
+        }
+        t->sync();
+    } else {
+        for (int i=0; i<num_bulk_task_launches; i++) {
+            int* in = (i % 2 == 0) ? input : output;
+            int* out = (i % 2 == 0) ? output : input;
+            parallel_for(*t, num_elements, [=](int el) {
+                out[el] = PingPongTask::ping_pong_work(base_iters, in[el]);
+            });
+        }
+    }
+    double end_time = CycleTimer::currentSeconds();
+
+    // Correctness validation
+    TestResults results;
+    results.passed = true;
+
+    int* buffer = (num_bulk_task_launches % 2 == 1) ? output : input;
+    for (int i=0; i<num_elements; i++) {
+        int value = i;
+        for (int j=0; j<num_bulk_task_launches; j++) {
+            value = PingPongTask::ping_pong_work(base_iters, value);
+        }
+
+        int expected = value;
+        if (buffer[i] != expected) {
+            results.passed = false;
+            printf("%d: %d expected=%d\n", i, buffer[i], expected);
+            break;
+        }
+    }
+    results.time = end_time - start_time;
+
+    delete [] input;
+    delete [] output;
+
+    return results;
+}
+
+TestResults superLightLambdaTest(ITaskSystem* t) {
+    return superLightLambdaTest(t, false);
+}
+
+TestResults superLightLambdaAsyncTest(ITaskSystem* t) {
+    return superLightLambdaTest(t, true);
+}
+
 /*
  * Computation: The following tests compute Fibonacci numbers using
  * recursion. Since the tasks are compute intensive, the tests show
@@ -776,6 +1096,49 @@ TestResults recursiveFibonacciAsyncTest(ITaskSystem* t) {
     return recursiveFibonacciTestBase(t, true);
 }
 
+/*
+ * Computation: the same Fibonacci recursion, but parallelized by tasks
+ * that launch and wait on their own sub-launches.  The task system must
+ * let a task wait on nested work without tying up its worker thread.
+ */
+TestResults nestedFibonacciTestBase(ITaskSystem* t, bool do_async) {
+
+    int fib_index = 34;
+    int cutoff = 22;
+
+    int task_output[2] = {0, 0};
+    NestedFibonacciTask root(t, fib_index, cutoff, do_async, task_output);
+
+    double start_time = CycleTimer::currentSeconds();
+    if (do_async) {
+        std::vector<TaskID> deps;
+        t->runAsyncWithDeps(&root, 2, deps);
+        t->sync();
+    } else {
+        t->run(&root, 2);
+    }
+    double end_time = CycleTimer::currentSeconds();
+
+    // Validate correctness
+    TestResults result;
+    int expected = root.slowFn(fib_index);
+    result.passed = task_output[0] + task_output[1] == expected;
+    if (!result.passed) {
+        printf("%d (expected %d)\n", task_output[0] + task_output[1], expected);
+    }
+    result.time = end_time - start_time;
+
+    return result;
+}
+
+TestResults recursiveFibonacciNestedTest(ITaskSystem* t) {
+    return nestedFibonacciTestBase(t, false);
+}
+
+TestResults recursiveFibonacciNestedAsyncTest(ITaskSystem* t) {
+    return nestedFibonacciTestBase(t, true);
+}
+
 /*
  * Computation: The following tests perform exps, logs, and multiplications
  * in a tight for loop. Tasks are sufficiently compute-intensive and lightweight:
@@ -861,6 +1224,62 @@ TestResults mathOperationsInTightForLoopAsyncTest(ITaskSystem* t) {
     return mathOperationsInTightForLoopTestBase(t, 16, true, true);
 }
 
+/*
+ * Computation: the 2000-launch chain of mathOperationsInTightForLoopAsyncTest,
+ * captured once into a TaskGraph before the timer starts and submitted
+ * with a single runGraph() call.  Every launch's output is checked, so
+ * a node that never ran is caught.
+ */
+TestResults mathOperationsInTightForLoopGraphTest(ITaskSystem* t) {
+    int num_tasks = 16;
+    int num_bulk_task_launches = 2000;
+
+    int array_size = 512;
+    float* task_output = new float[num_bulk_task_launches * array_size];
+
+    for (int i = 0; i < (num_bulk_task_launches * array_size); i++) {
+        task_output[i] = 0.0;
+    }
+
+    std::vector<MathOperationsInTightForLoopTask> medium_tasks;
+    for (int i = 0; i < num_bulk_task_launches; i++) {
+        medium_tasks.push_back(MathOperationsInTightForLoopTask(
+            array_size, &task_output[i*array_size]));
+    }
+
+    TaskGraphRecorder recorder;
+    TaskID prev_task_id;
+    for (int i = 0; i < num_bulk_task_launches; i++) {
+        std::vector<TaskID> deps;
+        if (i > 0) {
+            deps.push_back(prev_task_id);
+        }
+        prev_task_id = recorder.runAsyncWithDeps(&medium_tasks[i], num_tasks, deps);
+    }
+    TaskGraph graph = recorder.finish();
+
+    double start_time = CycleTimer::currentSeconds();
+    t->runGraph(graph);
+    t->sync();
+    double end_time = CycleTimer::currentSeconds();
+
+    TestResults result;
+    result.passed = true;
+    for (int i = 0; i < num_bulk_task_launches * array_size && result.passed; i++) {
+        int el = i % array_size;
+        int expected = (el % 3 == 0) ? 349 : (el % 3 == 1) ? 708 : 67950;
+        if (std::floor(task_output[i]) != expected) {
+            printf("%d: %f expected=%d\n", i, std::floor(task_output[i]), expected);
+            result.passed = false;
+        }
+    }
+    result.time = end_time - start_time;
+
+    delete [] task_output;
+
+    return result;
+}
+
 TestResults mathOperationsInTightForLoopFewerTasksTest(ITaskSystem* t) {
     return mathOperationsInTightForLoopTestBase(t, 9, false, false);
 }
@@ -1096,6 +1515,56 @@ TestResults mathOperationsInTightForLoopReductionTreeAsyncTest(ITaskSystem* t) {
     return mathOperationsInTightForLoopReductionTreeTestBase(t, true);
 }
 
+/*
+ * Computation: the fan-in and reduction-tree workloads above written as a
+ * single parallelReduce() launch.  Each of the `num_rows` rows is one
+ * MathOperationsInTightForLoopTask output array, and rows are summed
+ * elementwise through per-block partials instead of ReduceTask launches
+ * and scratch buffers.
+ */
+TestResults mathOperationsInTightForLoopReduceTestBase(ITaskSystem* t, int num_rows, int array_size,
+                                                       int expected0, int expected1) {
+    std::vector<float> zero(array_size, 0.0f);
+
+    double start_time = CycleTimer::currentSeconds();
+    std::vector<float> sum = parallelReduce(*t, num_rows, zero,
+        [array_size](int row) {
+            std::vector<float> values(array_size);
+            MathOperationsInTightForLoopTask task(array_size, values.data());
+            task.runTaskRange(0, 1, 1);
+            return values;
+        },
+        [](std::vector<float> acc, const std::vector<float>& values) {
+            for (size_t i = 0; i < acc.size(); i++) {
+                acc[i] += values[i];
+            }
+            return acc;
+        });
+    double end_time = CycleTimer::currentSeconds();
+
+    TestResults result;
+    result.passed = true;
+    for (int i = 0; i < array_size; i++) {
+        int expected = (i % 3 == 0) ? expected0 : (i % 3 == 1) ? expected1 : 67950 * num_rows;
+        if (std::floor(sum[i]) != expected) {
+            printf("%d: %f expected=%d\n", i, std::floor(sum[i]), expected);
+            result.passed = false;
+            break;
+        }
+    }
+    result.time = end_time - start_time;
+
+    return result;
+}
+
+TestResults mathOperationsInTightForLoopFanInReduceTest(ITaskSystem* t) {
+    return mathOperationsInTightForLoopReduceTestBase(t, 256, 2048, 89577, 181502);
+}
+
+TestResults mathOperationsInTightForLoopReductionTreeReduceTest(ITaskSystem* t) {
+    return mathOperationsInTightForLoopReduceTestBase(t, 32, 16384, 11197, 22687);
+}
+
 /*
  * Computation: In between two calls to a light weight task, these tests spawn
  * a medium weight bulk task launch that only has enough enough tasks to
@@ -1279,6 +1748,260 @@ TestResults simpleRunDepsTest(ITaskSystem *t) {
     return result;
 }
 
+/*
+ * Computation: A pipeline consumes the outputs of independent
+ * MathOperationsInTightForLoopTask launches one at a time, waiting on
+ * each launch with wait() instead of a global sync(). Checks that a
+ * launch's output is complete as soon as wait() on it returns, against
+ * a launch run serially up front.
+ */
+TestResults waitOnLaunchTest(ITaskSystem *t) {
+
+    int num_tasks = 16;
+    int num_bulk_task_launches = 64;
+    int array_size = 512;
+
+    float* reference = new float[array_size];
+    MathOperationsInTightForLoopTask(array_size, reference).runTaskRange(0, num_tasks, num_tasks);
+
+    // tasks only write positive values
+    float* task_output = new float[num_bulk_task_launches * array_size];
+    for (int i = 0; i < num_bulk_task_launches * array_size; i++) {
+        task_output[i] = -1.0;
+    }
+    std::vector<MathOperationsInTightForLoopTask> medium_tasks;
+    for (int i = 0; i < num_bulk_task_launches; i++) {
+        medium_tasks.push_back(MathOperationsInTightForLoopTask(
+            array_size, &task_output[i*array_size]));
+    }
+
+    TestResults result;
+    result.passed = true;
+
+    double start_time = CycleTimer::currentSeconds();
+    std::vector<TaskID> no_deps;
+    std::vector<TaskID> task_ids;
+    for (int i = 0; i < num_bulk_task_launches; i++) {
+        task_ids.push_back(t->runAsyncWithDeps(&medium_tasks[i], num_tasks, no_deps));
+    }
+    for (int i = 0; i < num_bulk_task_launches; i++) {
+        if (i % 2 == 0) {
+            t->wait(task_ids[i]);
+        } else {
+            while (!t->waitFor(task_ids[i], std::chrono::microseconds(100))) ;
+        }
+        if (!t->isDone(task_ids[i])) {
+            printf("launch %d not done after wait\n", i);
+            result.passed = false;
+        }
+        // consume this launch's output while later launches are in flight
+        for (int j = 0; j < array_size; j++) {
+            if (task_output[i*array_size + j] != reference[j]) {
+                printf("launch %d, %d: %f expected=%f\n", i, j, task_output[i*array_size + j], reference[j]);
+                result.passed = false;
+                break;
+            }
+        }
+    }
+    t->sync();
+    double end_time = CycleTimer::currentSeconds();
+    result.time = end_time - start_time;
+
+    delete [] reference;
+    delete [] task_output;
+
+    return result;
+}
+
+/*
+ * Computation: launchLatencyTest keeps a background of independent
+ * PingPongTask launches queued at PRIORITY_NORMAL while it submits small
+ * launches at `priority` one at a time, waiting for each.  The reported
+ * time is the 99th percentile of the small launches' submit-to-done
+ * latencies, not the run time of the test.
+ */
+TestResults launchLatencyTest(ITaskSystem* t, LaunchPriority priority) {
+    int num_samples = 128;
+    int num_background = 3;     // background launches kept in flight
+    int background_tasks = 64;
+    int background_elements = 4096;
+    int small_tasks = 4;
+    int small_elements = 64;
+    int iters = 512;
+
+    int* input = new int[background_elements];
+    for (int i = 0; i < background_elements; i++) {
+        input[i] = i;
+    }
+    int* small_output = new int[small_elements];
+    std::vector<int*> background_output;
+    std::vector<PingPongTask> background;
+    std::vector<TaskID> background_ids(num_background, -1);
+    for (int k = 0; k < num_background; k++) {
+        background_output.push_back(new int[background_elements]);
+        background.push_back(PingPongTask(background_elements, input, background_output[k], true, iters));
+    }
+    PingPongTask small(small_elements, input, small_output, true, iters);
+
+    TestResults results;
+    results.passed = true;
+    // ping_pong_work() adds one per even step
+    int added = (iters + 1) / 2;
+    auto check = [&](const int* output, int num_elements) {
+        for (int i = 0; i < num_elements; i++) {
+            if (output[i] != input[i] + added) {
+                printf("%d: %d expected=%d\n", i, output[i], input[i] + added);
+                results.passed = false;
+                return;
+            }
+        }
+    };
+
+    std::vector<double> latencies;
+    std::vector<TaskID> no_deps;
+    for (int s = 0; s < num_samples; s++) {
+        for (int k = 0; k < num_background; k++) {
+            if (background_ids[k] >= 0 && !t->isDone(background_ids[k])) {
+                continue;
+            }
+            if (background_ids[k] >= 0) {
+                check(background_output[k], background_elements);
+            }
+            background_ids[k] = t->runAsyncWithDeps(&background[k], background_tasks, no_deps);
+        }
+
+        double start_time = CycleTimer::currentSeconds();
+        TaskID id = t->runAsyncWithDeps(&small, small_tasks, no_deps, priority);
+        t->wait(id);
+        latencies.push_back(CycleTimer::currentSeconds() - start_time);
+        check(small_output, small_elements);
+    }
+    t->sync();
+    for (int k = 0; k < num_background; k++) {
+        check(background_output[k], background_elements);
+        delete [] background_output[k];
+    }
+
+    std::sort(latencies.begin(), latencies.end());
+    results.time = latencies[num_samples * 99 / 100];
+
+    delete [] input;
+    delete [] small_output;
+
+    return results;
+}
+
+TestResults highPriorityLatencyTest(ITaskSystem* t) {
+    return launchLatencyTest(t, PRIORITY_HIGH);
+}
+
+TestResults normalPriorityLatencyTest(ITaskSystem* t) {
+    return launchLatencyTest(t, PRIORITY_NORMAL);
+}
+
+/*
+ * Computation: several application threads submit small independent
+ * LightTask launches to the same task system at once, then the main
+ * thread syncs.  Measures how well concurrent submitters and the
+ * workers draining their launches stay out of each other's way.
+ */
+TestResults multiProducerSubmitTest(ITaskSystem* t) {
+    int num_producers = 4;
+    int num_launches = 1024;    // per producer
+    int num_tasks = 4;
+    int launch_size = num_producers * num_launches;
+
+    int* output = new int[launch_size * num_tasks];
+    for (int i = 0; i < launch_size * num_tasks; i++) {
+        output[i] = -1;
+    }
+    std::vector<LightTask> tasks;
+    for (int i = 0; i < launch_size; i++) {
+        tasks.push_back(LightTask(&output[i * num_tasks]));
+    }
+
+    double start_time = CycleTimer::currentSeconds();
+    std::vector<std::thread> producers;
+    for (int p = 0; p < num_producers; p++) {
+        producers.push_back(std::thread([&, p]() {
+            std::vector<TaskID> no_deps;
+            for (int i = 0; i < num_launches; i++) {
+                t->runAsyncWithDeps(&tasks[p * num_launches + i], num_tasks, no_deps);
+            }
+        }));
+    }
+    for (auto& producer : producers) {
+        producer.join();
+    }
+    t->sync();
+    double end_time = CycleTimer::currentSeconds();
+
+    TestResults results;
+    results.passed = true;
+    for (int i = 0; i < launch_size * num_tasks; i++) {
+        if (output[i] != i % num_tasks) {
+            printf("launch %d task %d: %d expected=%d\n", i / num_tasks, i % num_tasks, output[i], i % num_tasks);
+            results.passed = false;
+            break;
+        }
+    }
+    results.time = end_time - start_time;
+
+    delete [] output;
+
+    return results;
+}
+
+/*
+ * Computation: two application threads call run() on the same task
+ * system at once, each with launches large enough to be split, so both
+ * end up running tasks while they wait for their own launches.
+ */
+TestResults concurrentRunTest(ITaskSystem* t) {
+    int num_callers = 2;
+    int num_launches = 64;      // per caller
+    int num_tasks = 256;
+    int launch_size = num_callers * num_launches;
+
+    int* output = new int[launch_size * num_tasks];
+    for (int i = 0; i < launch_size * num_tasks; i++) {
+        output[i] = -1;
+    }
+    std::vector<LightTask> tasks;
+    for (int i = 0; i < launch_size; i++) {
+        tasks.push_back(LightTask(&output[i * num_tasks]));
+    }
+
+    double start_time = CycleTimer::currentSeconds();
+    std::vector<std::thread> callers;
+    for (int c = 0; c < num_callers; c++) {
+        callers.push_back(std::thread([&, c]() {
+            for (int i = 0; i < num_launches; i++) {
+                t->run(&tasks[c * num_launches + i], num_tasks);
+            }
+        }));
+    }
+    for (auto& caller : callers) {
+        caller.join();
+    }
+    double end_time = CycleTimer::currentSeconds();
+
+    TestResults results;
+    results.passed = true;
+    for (int i = 0; i < launch_size * num_tasks; i++) {
+        if (output[i] != i % num_tasks) {
+            printf("launch %d task %d: %d expected=%d\n", i / num_tasks, i % num_tasks, output[i], i % num_tasks);
+            results.passed = false;
+            break;
+        }
+    }
+    results.time = end_time - start_time;
+
+    delete [] output;
+
+    return results;
+}
+
 /*
  * This test makes dependencies in a diamond topology are satisfied.
  */
@@ -1337,7 +2060,7 @@ TestResults strictDiamondDepsTest(ITaskSystem *t) {
  * These tests generates and run a random DAG of n tasks and at most m edges,
  * and make all dependencies are satisfied.
  */
-TestResults strictGraphDepsTestBase(ITaskSystem*t, int n, int m, unsigned int seed) {
+TestResults strictGraphDepsTestBase(ITaskSystem*t, int n, int m, unsigned int seed, bool batched = false) {
     // For repeatability.
     srand(seed);
 
@@ -1374,20 +2097,33 @@ TestResults strictGraphDepsTestBase(ITaskSystem*t, int n, int m, unsigned int se
         tasks.push_back(new StrictDependencyTask(flag_deps[i], done + i));
     }
 
+    bool ids_ok = true;
     double start_time = CycleTimer::currentSeconds();
-    for (int i = 0; i < n; i++) {
-        // Populate TaskID deps.
-        for (int idx : idx_deps[i]) {
-            task_deps[i].push_back(task_ids[idx]);
+    if (batched) {
+        // Submit the whole graph in one call, deps as indices into the batch.
+        std::vector<LaunchDesc> batch(n);
+        for (int i = 0; i < n; i++) {
+            batch[i].runnable = tasks[i];
+            batch[i].num_total_tasks = (rand() % 15) + 1;
+            batch[i].batch_deps = idx_deps[i];
+        }
+        std::vector<TaskID> ids = t->submitBatch(batch);
+        ids_ok = (int)ids.size() == n;
+    } else {
+        for (int i = 0; i < n; i++) {
+            // Populate TaskID deps.
+            for (int idx : idx_deps[i]) {
+                task_deps[i].push_back(task_ids[idx]);
+            }
+            // Launch async and record this task's id.
+            task_ids[i] = t->runAsyncWithDeps(tasks[i], (rand() % 15) + 1, task_deps[i]);
         }
-        // Launch async and record this task's id.
-        task_ids[i] = t->runAsyncWithDeps(tasks[i], (rand() % 15) + 1, task_deps[i]);
     }
     t->sync();
     double end_time = CycleTimer::currentSeconds();
     
     TestResults result;
-    result.passed = done[n-1];
+    result.passed = done[n-1] && ids_ok;
     result.time = end_time - start_time;
     return result;
 }
@@ -1403,3 +2139,7 @@ TestResults strictGraphDepsMedium(ITaskSystem* t) {
 TestResults strictGraphDepsLarge(ITaskSystem* t) {
     return strictGraphDepsTestBase(t,1000,20000,0);
 }
+
+TestResults strictGraphDepsLargeBatch(ITaskSystem* t) {
+    return strictGraphDepsTestBase(t,1000,20000,0,true);
+}